@@ -0,0 +1,107 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#ifndef __BENCH_HPP__
+#define __BENCH_HPP__
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+
+#define concatenate_name(x,y) x ## y
+#define make_function_name(line) concatenate_name(benchmark_, line)
+#define make_registrar_name(line) concatenate_name(register_benchmark_, line)
+#define RUN_BENCH(name) \
+  static void make_function_name(__LINE__) (bench_state &); \
+  static bench_registrar make_registrar_name(__LINE__) (name, make_function_name(__LINE__)); \
+  static void make_function_name(__LINE__) (bench_state &bench)
+
+/// One measurement, as it will be written to the JSON report.
+struct bench_result {
+  std::string bench;
+  std::string metric;
+  size_t items;        ///< The number of items (entries, characters...) processed per run
+  size_t runs;
+  double ns_min;       ///< Fastest run, in nanoseconds
+  double ns_median;    ///< Median run, in nanoseconds
+};
+
+/// Handed to each benchmark to time its runs and record results.
+class bench_state {
+  std::string name;
+  std::vector<bench_result> *results;
+
+  public:
+  /// Multiplies the default input sizes; set with --scale.
+  double scale;
+  /// Whether to include the largest inputs (10^6 zip entries and so on); set with --large.
+  bool large;
+  /// How much data, in MiB, packing benchmarks should generate; set with --pack-mb.
+  size_t pack_mb;
+  /// How many times each measurement is repeated; set with --runs.
+  size_t runs;
+
+  bench_state(std::string n, std::vector<bench_result> *r, double sc, bool lg, size_t pmb, size_t rn):
+      name(n), results(r), scale(sc), large(lg), pack_mb(pmb), runs(rn) {}
+
+  /// Scale a default input size.
+  size_t scaled(size_t n) const { return std::max<size_t>(1, size_t(n * scale)); }
+
+  /// Time a function over several runs, recording the fastest and the
+  /// median. The function is called once beforehand to warm caches.
+  template<class F> void measure(std::string metric, size_t items, F f) {
+    typedef std::chrono::steady_clock clock;
+    std::vector<double> times;
+    f();
+    for (size_t i = 0; i < runs; ++i) {
+      clock::time_point start = clock::now();
+      f();
+      times.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    bench_result r = { name, metric, items, runs, times.front(), times[times.size() / 2] };
+    results->push_back(r);
+  }
+
+  /// Time a function exactly once, for operations too expensive to repeat.
+  template<class F> void measure_once(std::string metric, size_t items, F f) {
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    f();
+    double t = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    bench_result r = { name, metric, items, 1, t, t };
+    results->push_back(r);
+  }
+};
+
+struct bench_registrar {
+  typedef void(*bench_function)(bench_state &);
+  typedef std::pair<std::string, bench_function> bench_pair;
+  typedef std::deque<bench_pair> bench_collection;
+  static bench_collection &all_benches();
+  bench_registrar(std::string name, bench_function function) {
+    all_benches().push_back(bench_pair(name, function));
+  }
+};
+
+/// Keep the optimizer from discarding a value computed by a benchmark.
+template<class T> inline void do_not_optimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif
@@ -0,0 +1,97 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <exception>
+
+#include "bench.hpp"
+
+bench_registrar::bench_collection &bench_registrar::all_benches() {
+  static bench_collection *all_benches_ = new bench_collection();
+  return *all_benches_;
+}
+
+static std::string json_string(const std::string &s) {
+  std::string res = "\"";
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') res += '\\';
+    if ((unsigned char) s[i] < 0x20) res += ' ';
+    else res += s[i];
+  }
+  return res + "\"";
+}
+
+static void usage() {
+  std::cerr << "Usage: EGMRead [--scale X] [--large] [--pack-mb N] [--runs N] [--filter TEXT]" << std::endl
+            << "Runs each benchmark and prints the results as JSON on standard output." << std::endl;
+}
+
+int main(int argc, char **argv) {
+  double scale = 1;
+  bool large = false;
+  size_t pack_mb = 64, runs = 5;
+  std::string filter;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--scale" && has_value) scale = atof(argv[++i]);
+    else if (arg == "--large") large = true;
+    else if (arg == "--pack-mb" && has_value) pack_mb = strtoul(argv[++i], NULL, 10);
+    else if (arg == "--runs" && has_value) runs = strtoul(argv[++i], NULL, 10);
+    else if (arg == "--filter" && has_value) filter = argv[++i];
+    else { usage(); return 2; }
+  }
+  if (!runs) runs = 1;
+
+  std::vector<bench_result> results;
+  bool had_failures = false;
+  for (bench_registrar::bench_collection::iterator it = bench_registrar::all_benches().begin();
+       it != bench_registrar::all_benches().end(); ++it) {
+    if (!filter.empty() && it->first.find(filter) == std::string::npos)
+      continue;
+    std::cerr << it->first << "... " << std::flush;
+    bench_state state(it->first, &results, scale, large, pack_mb, runs);
+    try {
+      it->second(state);
+      std::cerr << "done" << std::endl;
+    }
+    catch (std::exception &e) { had_failures = true; std::cerr << "FAIL: " << e.what() << std::endl; }
+    catch (const char *e)     { had_failures = true; std::cerr << "FAIL: " << e << std::endl; }
+  }
+
+  std::cout << "{" << std::endl
+            << "  \"format\": 1," << std::endl
+            << "  \"unix_time\": " << time(NULL) << "," << std::endl
+            << "  \"compiler\": " << json_string(__VERSION__) << "," << std::endl
+            << "  \"options\": { \"scale\": " << scale << ", \"large\": " << (large? "true" : "false")
+            << ", \"pack_mb\": " << pack_mb << ", \"runs\": " << runs << " }," << std::endl
+            << "  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const bench_result &r = results[i];
+    std::cout << (i? "," : "") << std::endl << "    { \"bench\": " << json_string(r.bench)
+              << ", \"metric\": " << json_string(r.metric)
+              << ", \"items\": " << r.items << ", \"runs\": " << r.runs
+              << ", \"ns_min\": " << size_t(r.ns_min) << ", \"ns_median\": " << size_t(r.ns_median)
+              << ", \"ns_per_item\": " << r.ns_median / (r.items? r.items : 1) << " }";
+  }
+  std::cout << std::endl << "  ]" << std::endl << "}" << std::endl;
+  delete &bench_registrar::all_benches();
+  return had_failures;
+}
@@ -0,0 +1,139 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "bench.hpp"
+#include "generators.hpp"
+#include <datastore.hpp>
+#include <cstdlib>
+#include <sstream>
+#include <fstream>
+
+using std::string;
+
+/// An object as the ad-hoc text formats describe it, one key=value per line.
+struct game_object {
+  string name;
+  int x, y, sprite;
+  double depth;
+  std::vector<int> path;
+};
+
+enum { F_NAME, F_X, F_Y, F_SPRITE, F_DEPTH, F_PATH };
+
+static game_object make_object(size_t i) {
+  std::stringstream name;
+  name << "obj_" << i;
+  game_object o = { name.str(), int(i % 640), int(i % 480), int(i % 37), double(i % 100) - 50, std::vector<int>(i % 8, int(i)) };
+  return o;
+}
+
+static string write_text(const std::vector<game_object> &objects) {
+  std::stringstream ss;
+  for (size_t i = 0; i < objects.size(); ++i) {
+    const game_object &o = objects[i];
+    ss << "[object]\nname=" << o.name << "\nx=" << o.x << "\ny=" << o.y << "\nsprite=" << o.sprite
+       << "\ndepth=" << o.depth << "\npath=";
+    for (size_t j = 0; j < o.path.size(); ++j)
+      ss << (j? "," : "") << o.path[j];
+    ss << "\n";
+  }
+  return ss.str();
+}
+
+/// Parse everything, the way the loaders this layer replaces do.
+static std::vector<game_object> parse_text(const string &text) {
+  std::vector<game_object> res;
+  size_t at = 0;
+  while (at < text.size()) {
+    size_t eol = text.find('\n', at);
+    if (eol == string::npos) eol = text.size();
+    string line = text.substr(at, eol - at);
+    at = eol + 1;
+    if (line == "[object]") { res.push_back(game_object()); continue; }
+    size_t eq = line.find('=');
+    if (eq == string::npos || res.empty()) continue;
+    string key = line.substr(0, eq), value = line.substr(eq + 1);
+    game_object &o = res.back();
+    if (key == "name") o.name = value;
+    else if (key == "x") o.x = atoi(value.c_str());
+    else if (key == "y") o.y = atoi(value.c_str());
+    else if (key == "sprite") o.sprite = atoi(value.c_str());
+    else if (key == "depth") o.depth = atof(value.c_str());
+    else if (key == "path")
+      for (size_t p = 0; p < value.size(); ) {
+        o.path.push_back(atoi(value.c_str() + p));
+        p = value.find(',', p);
+        p = p == string::npos? value.size() : p + 1;
+      }
+  }
+  return res;
+}
+
+static string write_binary(const std::vector<game_object> &objects) {
+  eff::data_builder b(1);
+  std::vector<eff::data_builder::ref> refs;
+  for (size_t i = 0; i < objects.size(); ++i) {
+    const game_object &o = objects[i];
+    eff::data_builder::ref name = b.add_string(o.name), path = b.add_vector(o.path);
+    b.start_table();
+    b.field_ref(F_NAME, name);
+    b.field<int32_t>(F_X, o.x);
+    b.field<int32_t>(F_Y, o.y);
+    b.field<int32_t>(F_SPRITE, o.sprite);
+    b.field<double>(F_DEPTH, o.depth);
+    b.field_ref(F_PATH, path);
+    refs.push_back(b.end_table());
+  }
+  eff::data_builder::ref all = b.add_refs(refs);
+  b.start_table();
+  b.field_ref(0, all);
+  return b.finish(b.end_table());
+}
+
+RUN_BENCH("Data storage against parse-everything loading") {
+  const size_t count = bench.scaled(100000);
+  std::vector<game_object> objects;
+  for (size_t i = 0; i < count; ++i)
+    objects.push_back(make_object(i));
+
+  scratch_dir scratch;
+  const string text = write_text(objects), binary = write_binary(objects);
+  std::ofstream((scratch / "objects.effd").c_str(), std::ios::out | std::ios::binary) << binary;
+
+  bench.measure("text/parse_all", count, [&]() {
+    do_not_optimize(parse_text(text).size());
+  });
+  bench.measure("datastore/open", 1, [&]() {
+    eff::data_file f(scratch / "objects.effd");
+    do_not_optimize(f.reader().root().get_refs(0).size());
+  });
+  eff::data_file file(scratch / "objects.effd");
+  const eff::data_ref_vector all = file.reader().root().get_refs(0);
+  bench.measure("datastore/one_field_of_each", count, [&]() {
+    int sum = 0;
+    for (size_t i = 0; i < all.size(); ++i)
+      sum += all.get_table(i).get<int32_t>(F_SPRITE);
+    do_not_optimize(sum);
+  });
+  bench.measure("datastore/every_field_of_each", count, [&]() {
+    double sum = 0;
+    for (size_t i = 0; i < all.size(); ++i) {
+      eff::data_table t = all.get_table(i);
+      sum += t.get_string(F_NAME).size() + t.get<int32_t>(F_X) + t.get<int32_t>(F_Y)
+           + t.get<int32_t>(F_SPRITE) + t.get<double>(F_DEPTH) + t.get_vector<int>(F_PATH).size();
+    }
+    do_not_optimize(sum);
+  });
+}
@@ -0,0 +1,274 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "bench.hpp"
+#include "generators.hpp"
+#include <gdir.hpp>
+#include <gdir_diff.hpp>
+#include <gdir_memory.hpp>
+#include <zip_writer.hpp>
+#include <utf8_fold.hpp>
+#include <memory_resource>
+#include <sstream>
+#include <stdexcept>
+
+using std::string;
+
+/// Visit every entry below a directory, depth first, the way print_tree does.
+static size_t walk(eff::directory dir) {
+  size_t count = 0;
+  for (string fn = dir.first_file(); !fn.empty(); fn = dir.next_file())
+    ++count;
+  for (string dn = dir.first_directory(); !dn.empty(); dn = dir.next_directory()) {
+    eff::directory sub = dir.enter_new(dn);
+    count += 1 + (sub.good()? walk(sub) : 0);
+  }
+  return count;
+}
+
+/// The same walk, fetching entries in batches of views.
+static size_t walk_batched(eff::directory dir) {
+  eff::entry_view batch[256];
+  size_t count = 0, n;
+  dir.rewind_files();
+  while ((n = dir.next_files(batch)))
+    count += n;
+  std::vector<string> subdirs;
+  dir.rewind_directories();
+  while ((n = dir.next_directories(batch)))
+    for (size_t i = 0; i < n; ++i)
+      subdirs.push_back(batch[i].str());
+  for (size_t i = 0; i < subdirs.size(); ++i) {
+    eff::directory sub = dir.enter_new(subdirs[i]);
+    count += 1 + (sub.good()? walk_batched(sub) : 0);
+  }
+  return count;
+}
+
+/// Enter and leave each subdirectory of a directory in turn.
+static size_t enter_leave(eff::directory &dir) {
+  size_t count = 0;
+  for (string dn = dir.first_directory(); !dn.empty(); dn = dir.next_directory())
+    if (dir.enter_new(dn).good())
+      ++count;
+  std::vector<string> names;
+  for (string dn = dir.first_directory(); !dn.empty(); dn = dir.next_directory())
+    names.push_back(dn);
+  for (size_t i = 0; i < names.size(); ++i)
+    if (dir.enter(names[i]) && dir.leave())
+      ++count;
+  return count;
+}
+
+static void bench_directory(bench_state &bench, const string &label, eff::directory (*open)(string), const string &path) {
+  eff::directory probe = open(path);
+  if (!probe.good())
+    throw std::runtime_error("Couldn't open " + path);
+  const size_t entries = walk(probe);
+  bench.measure(label + "/open", 1, [&]() {
+    eff::directory d = open(path);
+    do_not_optimize(d.good());
+  });
+  bench.measure(label + "/iterate_all", entries, [&]() {
+    do_not_optimize(walk(open(path)));
+  });
+  eff::directory root = open(path);
+  const size_t subdirs = 2 * root.directory_count();
+  bench.measure(label + "/enter_leave", subdirs, [&]() {
+    do_not_optimize(enter_leave(root));
+  });
+}
+
+static eff::directory dirent_prefetched(string path) {
+  return eff::dirent(path, eff::prefetch_options());
+}
+
+RUN_BENCH("Directory trees on disk") {
+  scratch_dir scratch;
+  tree_shape deep = { 10, 2, unsigned(bench.scaled(4)), 16 };
+  tree_shape wide = { 1, 32, unsigned(bench.scaled(512)), 16 };
+  make_tree(scratch / "deep", deep);
+  make_tree(scratch / "wide", wide);
+  bench_directory(bench, "dirent/deep", eff::dirent, scratch / "deep");
+  bench_directory(bench, "dirent/wide", eff::dirent, scratch / "wide");
+  bench_directory(bench, "dirent_prefetch/deep", dirent_prefetched, scratch / "deep");
+  bench_directory(bench, "dirent_prefetch/wide", dirent_prefetched, scratch / "wide");
+}
+
+RUN_BENCH("Simulated disks") {
+  eff::memory_backend fs;
+  tree_shape shape = { 3, 8, unsigned(bench.scaled(16)), 16 };
+  make_tree(fs, "tree", shape);
+  const size_t entries = shape.entry_count();
+  const eff::prefetch_options ahead(8, 2, 8);
+  // With no latency, what's left is the cost of the walk itself.
+  bench.measure("memory/iterate_all", entries, [&]() {
+    do_not_optimize(walk(eff::dirent("tree", fs)));
+  });
+  bench.measure("memory_prefetch/iterate_all", entries, [&]() {
+    do_not_optimize(walk(eff::dirent("tree", fs, ahead)));
+  });
+  // A network share or a cold disk, taking 100us to list each directory.
+  fs.set_latency(std::chrono::microseconds(100));
+  bench.measure("slow_memory/iterate_all", entries, [&]() {
+    do_not_optimize(walk(eff::dirent("tree", fs)));
+  });
+  bench.measure("slow_memory_prefetch/iterate_all", entries, [&]() {
+    do_not_optimize(walk(eff::dirent("tree", fs, ahead)));
+  });
+}
+
+RUN_BENCH("Zip archives") {
+  scratch_dir scratch;
+  size_t sizes[] = { 1000, 10000, 100000, 1000000 };
+  for (size_t i = 0; i < sizeof sizes / sizeof *sizes; ++i) {
+    if (sizes[i] > 100000 && !bench.large)
+      continue;
+    const size_t entries = bench.scaled(sizes[i]);
+    std::stringstream label;
+    label << "dirent_zip/" << entries;
+    const string zipfile = scratch / (label.str().substr(11) + ".zip");
+    make_zip(zipfile, entries, 100);
+    bench_directory(bench, label.str(), eff::dirent_zip, zipfile);
+  }
+}
+
+RUN_BENCH("Batched iteration") {
+  scratch_dir scratch;
+  const size_t entries = bench.scaled(1000000);
+  make_zip(scratch / "batched.zip", entries, 10000);
+  eff::directory root = eff::dirent_zip(scratch / "batched.zip");
+  if (!root.good())
+    throw std::runtime_error("Couldn't open the generated zip");
+  bench.measure("dirent_zip/next_file", entries, [&]() {
+    do_not_optimize(walk(root));
+  });
+  bench.measure("dirent_zip/next_files", entries, [&]() {
+    do_not_optimize(walk_batched(root));
+  });
+}
+
+RUN_BENCH("Visitor iteration") {
+  scratch_dir scratch;
+  const size_t entries = bench.scaled(100000);
+  make_zip(scratch / "visited.zip", entries, entries);
+  eff::directory dir = eff::dirent_zip(scratch / "visited.zip");
+  if (!dir.enter("dir_0"))
+    throw std::runtime_error("Couldn't open the generated zip");
+  std::vector<eff::entry_view> plain;
+  dir.for_each_file([&](const eff::entry_view &e) { plain.push_back(e); });
+  bench.measure("zip/next_file", entries, [&]() {
+    size_t bytes = 0;
+    for (string fn = dir.first_file(); !fn.empty(); fn = dir.next_file())
+      bytes += fn.size();
+    do_not_optimize(bytes);
+  });
+  bench.measure("zip/next_files", entries, [&]() {
+    eff::entry_view batch[256];
+    size_t bytes = 0, n;
+    dir.rewind_files();
+    while ((n = dir.next_files(batch)))
+      for (size_t i = 0; i < n; ++i)
+        bytes += batch[i].length;
+    do_not_optimize(bytes);
+  });
+  bench.measure("zip/for_each_file", entries, [&]() {
+    size_t bytes = 0;
+    dir.for_each_file([&](const eff::entry_view &e) { bytes += e.length; });
+    do_not_optimize(bytes);
+  });
+  bench.measure("plain_array_scan", entries, [&]() {
+    size_t bytes = 0;
+    for (size_t i = 0; i < plain.size(); ++i)
+      bytes += plain[i].length;
+    do_not_optimize(bytes);
+  });
+}
+
+RUN_BENCH("Mount memory") {
+  scratch_dir scratch;
+  const size_t entries = bench.scaled(200000);
+  make_zip(scratch / "mounted.zip", entries, 1000);
+  const string zipfile = scratch / "mounted.zip";
+  bench.measure("dirent_zip/heap", entries, [&]() {
+    eff::directory dir = eff::dirent_zip(zipfile);
+    do_not_optimize(dir.directory_count());
+  });
+  std::pmr::monotonic_buffer_resource arena;
+  bench.measure("dirent_zip/arena", entries, [&]() {
+    {
+      eff::directory dir = eff::dirent_zip(zipfile, &arena);
+      do_not_optimize(dir.directory_count());
+    }
+    arena.release();
+  });
+}
+
+/// How lookups ignoring case worked before LOOKUP_FOLDED: fold every name.
+static bool scan_folded(eff::directory &dir, const string &name) {
+  const string key = utf8::fold_key(name);
+  for (string f = dir.first_file(); !f.empty(); f = dir.next_file())
+    if (utf8::fold_key(f) == key)
+      return true;
+  return false;
+}
+
+RUN_BENCH("Folded lookup") {
+  scratch_dir scratch;
+  const size_t entries = bench.scaled(10000), scans = bench.scaled(100);
+  make_zip(scratch / "lookup.zip", entries, entries);
+  eff::directory dir = eff::dirent_zip(scratch / "lookup.zip");
+  if (!dir.enter("dir_0"))
+    throw std::runtime_error("Couldn't open the generated zip");
+  std::vector<string> names;
+  for (size_t i = 0; i < entries; ++i) {
+    std::stringstream name;
+    name << "FILE_" << i << ".TXT";
+    names.push_back(name.str());
+  }
+  bench.measure("zip/scan_folding_each_name", scans, [&]() {
+    size_t found = 0;
+    for (size_t i = 0; i < scans; ++i)
+      found += scan_folded(dir, names[i * (entries / scans)]);
+    do_not_optimize(found);
+  });
+  dir.set_lookup(eff::LOOKUP_FOLDED);
+  bench.measure("zip/has_file_folded", entries, [&]() {
+    size_t found = 0;
+    for (size_t i = 0; i < entries; ++i)
+      found += dir.has_file(names[i]);
+    do_not_optimize(found);
+  });
+}
+
+RUN_BENCH("Tree diff") {
+  scratch_dir scratch;
+  tree_shape shape = { 3, 8, unsigned(bench.scaled(64)), 4096 };
+  make_tree(scratch / "tree", shape);
+  eff::zip_writer zw(scratch / "tree.zip");
+  zw.add_tree(scratch / "tree");
+  if (!zw.close())
+    throw std::runtime_error("Couldn't pack the generated tree");
+  eff::directory tree = eff::dirent(scratch / "tree"), zip = eff::dirent_zip(scratch / "tree.zip");
+  const size_t entries = shape.entry_count();
+  bench.measure("diff/unchanged_by_metadata", entries, [&]() {
+    do_not_optimize(eff::diff(tree, zip).changes.size());
+  });
+  eff::diff_options by_contents;
+  by_contents.trust_mtime = false;
+  bench.measure("diff/unchanged_by_contents", entries, [&]() {
+    do_not_optimize(eff::diff(tree, zip, by_contents).changes.size());
+  });
+}
@@ -0,0 +1,166 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "generators.hpp"
+#include <zip_writer.hpp>
+#include <gdir_memory.hpp>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static uint32_t next_random(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+/* ***************************************************************************** *\
+|* Scratch space *************************************************************** *|
+\* ***************************************************************************** */
+
+scratch_dir::scratch_dir(): path_() {
+  const char *tmp = getenv("TMPDIR");
+  std::string tmpl = std::string(tmp && *tmp? tmp : "/tmp") + "/eff_bench_XXXXXX";
+  if (!mkdtemp(&tmpl[0]))
+    throw std::runtime_error("Couldn't create a scratch directory in " + tmpl);
+  path_ = tmpl;
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+  return remove(path);
+}
+
+scratch_dir::~scratch_dir() {
+  nftw(path_.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/* ***************************************************************************** *\
+|* Trees and archives ********************************************************** *|
+\* ***************************************************************************** */
+
+size_t tree_shape::entry_count() const {
+  size_t dirs = 1, total = 0;
+  for (unsigned d = 0; d <= depth; ++d) {
+    total += dirs * files;
+    if (d < depth) {
+      dirs *= fanout;
+      total += dirs;
+    }
+  }
+  return total;
+}
+
+static void make_level(const std::string &path, const tree_shape &shape, unsigned depth, const std::string &contents) {
+  for (unsigned f = 0; f < shape.files; ++f) {
+    std::stringstream name;
+    name << path << "/file_" << f << ".txt";
+    std::ofstream(name.str().c_str(), std::ios::out | std::ios::binary) << contents;
+  }
+  if (depth >= shape.depth)
+    return;
+  for (unsigned d = 0; d < shape.fanout; ++d) {
+    std::stringstream name;
+    name << path << "/dir_" << d;
+    mkdir(name.str().c_str(), 0755);
+    make_level(name.str(), shape, depth + 1, contents);
+  }
+}
+
+void make_tree(const std::string &root, const tree_shape &shape) {
+  mkdir(root.c_str(), 0755);
+  make_level(root, shape, 0, std::string(shape.file_size, 'x'));
+}
+
+static void make_level(eff::memory_backend &fs, const std::string &path, const tree_shape &shape, unsigned depth,
+                       const std::string &contents) {
+  fs.add_directory(path);
+  for (unsigned f = 0; f < shape.files; ++f) {
+    std::stringstream name;
+    name << path << "/file_" << f << ".txt";
+    fs.add_file(name.str(), contents);
+  }
+  if (depth >= shape.depth)
+    return;
+  for (unsigned d = 0; d < shape.fanout; ++d) {
+    std::stringstream name;
+    name << path << "/dir_" << d;
+    make_level(fs, name.str(), shape, depth + 1, contents);
+  }
+}
+
+void make_tree(eff::memory_backend &fs, const std::string &root, const tree_shape &shape) {
+  make_level(fs, root, shape, 0, std::string(shape.file_size, 'x'));
+}
+
+void make_zip(const std::string &zipfile, size_t entries, size_t per_dir, size_t file_size) {
+  eff::zip_writer zw(zipfile);
+  const std::string contents(file_size, 'x');
+  for (size_t i = 0; i < entries; ++i) {
+    std::stringstream name;
+    name << "dir_" << i / per_dir << "/file_" << i % per_dir << ".txt";
+    zw.add_memory(name.str(), contents, eff::zip_writer::STORED);
+  }
+  if (!zw.close())
+    throw std::runtime_error("Couldn't write " + zipfile);
+}
+
+/* ***************************************************************************** *\
+|* Text and data *************************************************************** *|
+\* ***************************************************************************** */
+
+std::string ascii_text(size_t chars, uint32_t seed) {
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz      ABCDEFGHIJ0123456789.,;()\n";
+  std::string res;
+  res.reserve(chars);
+  for (size_t i = 0; i < chars; ++i)
+    res += alphabet[next_random(seed) % (sizeof alphabet - 1)];
+  return res;
+}
+
+std::string multilingual_text(size_t chars, uint32_t seed) {
+  static const char *const samples[] = {
+    "a", "e", " ", "z", "\n",     // ASCII
+    "\xCE\xB3", "\xCE\xBA",       // Greek
+    "\xD0\x96", "\xD0\xB4",       // Cyrillic
+    "\xE6\x97\xA5", "\xE8\xAA\x9E", // CJK
+    "\xE2\x82\xAC",               // Euro sign
+    "\xF0\x9F\x98\x80"            // Emoji
+  };
+  std::string res;
+  res.reserve(chars * 2);
+  for (size_t i = 0; i < chars; ++i)
+    res += samples[next_random(seed) % (sizeof samples / sizeof *samples)];
+  return res;
+}
+
+std::string asset_bytes(size_t bytes, uint32_t seed) {
+  std::string res;
+  res.reserve(bytes);
+  while (res.size() < bytes) {
+    uint32_t r = next_random(seed);
+    if (r & 1)
+      res += ascii_text(std::min<size_t>(64, bytes - res.size()), r);
+    else for (int i = 0; i < 16 && res.size() < bytes; ++i)
+      res += char(next_random(seed));
+  }
+  return res;
+}
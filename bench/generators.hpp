@@ -0,0 +1,66 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#ifndef __BENCH_GENERATORS_HPP__
+#define __BENCH_GENERATORS_HPP__
+
+#include <string>
+#include <stdint.h>
+
+namespace eff { class memory_backend; }
+
+/// A scratch directory, removed with everything in it when destroyed.
+class scratch_dir {
+  std::string path_;
+  scratch_dir(const scratch_dir&);
+  scratch_dir &operator=(const scratch_dir&);
+
+  public:
+  scratch_dir();
+  ~scratch_dir();
+  const std::string &path() const { return path_; }
+  std::string operator/(const std::string &name) const { return path_ + "/" + name; }
+};
+
+/// The shape of a synthetic directory tree: every directory down to the
+/// given depth holds `fanout' subdirectories and `files' files.
+struct tree_shape {
+  unsigned depth;
+  unsigned fanout;
+  unsigned files;
+  size_t file_size;
+  /// The number of files and directories, not counting the root.
+  size_t entry_count() const;
+};
+
+/// Create a directory tree with the given shape under the given path.
+void make_tree(const std::string &root, const tree_shape &shape);
+/// The same, in memory.
+void make_tree(eff::memory_backend &fs, const std::string &root, const tree_shape &shape);
+
+/// Create a zip file with the given number of small STORED entries, spread
+/// over directories holding `per_dir' entries each.
+void make_zip(const std::string &zipfile, size_t entries, size_t per_dir, size_t file_size = 16);
+
+/// Deterministic pseudo-random text; multilingual text mixes ASCII with two-,
+/// three- and four-byte characters.
+std::string ascii_text(size_t chars, uint32_t seed = 1);
+std::string multilingual_text(size_t chars, uint32_t seed = 1);
+
+/// Deterministic pseudo-random bytes, compressible about as well as typical
+/// game assets (a mix of text-like runs and noise).
+std::string asset_bytes(size_t bytes, uint32_t seed = 1);
+
+#endif
@@ -0,0 +1,89 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "bench.hpp"
+#include "generators.hpp"
+#include <utf8_string.hpp>
+
+using std::string;
+
+static void bench_text(bench_state &bench, const string &label, const string &text) {
+  const utf8::utf8_string str = text;
+  const size_t chars = str.length();
+
+  bench.measure(label + "/construct", chars, [&]() {
+    utf8::utf8_string s = text;
+    do_not_optimize(s.length());
+  });
+
+  // Visit characters in a scattered order, so each at() finds a checkpoint
+  // and scans forward from it rather than benefiting from the last call.
+  const size_t lookups = std::min<size_t>(chars, 100000);
+  bench.measure(label + "/at", lookups, [&]() {
+    int sum = 0;
+    for (size_t i = 0, at = 0; i < lookups; ++i, at = (at + 7919) % chars)
+      sum += str.at(at);
+    do_not_optimize(sum);
+  });
+
+  // Map scattered characters to line:column, as compiler diagnostics do,
+  // against finding each by scanning from the start.
+  bench.measure(label + "/line_col_of", lookups, [&]() {
+    size_t sum = 0;
+    for (size_t i = 0, at = 0; i < lookups; ++i, at = (at + 7919) % chars)
+      sum += str.line_col_of(at).column;
+    do_not_optimize(sum);
+  });
+  const size_t rescans = std::min<size_t>(lookups, 64);
+  bench.measure(label + "/line_col_by_rescan", rescans, [&]() {
+    size_t sum = 0;
+    for (size_t i = 0, at = 0; i < rescans; ++i, at = (at + 7919) % chars) {
+      size_t column = 0;
+      for (size_t c = 0; c < at; ++c)
+        column = str.at(c) == '\n'? 0 : column + 1;
+      sum += column;
+    }
+    do_not_optimize(sum);
+  });
+  
+  // Look for a character that isn't there, so the whole string is searched.
+  bench.measure(label + "/find_absent", chars, [&]() {
+    do_not_optimize(str.find(U'\x2603'));
+  });
+  bench.measure(label + "/find_absent_by_at", chars, [&]() {
+    size_t found = utf8::utf8_string::npos;
+    for (size_t i = 0; i < chars && found == utf8::utf8_string::npos; ++i)
+      if (str.at(i) == 0x2603)
+        found = i;
+    do_not_optimize(found);
+  });
+  
+  // Append pieces of 64 characters, as a text editor or a code generator might.
+  std::vector<utf8::utf8_string> pieces;
+  for (size_t i = 0; i + 64 <= chars && pieces.size() < 4096; i += 64)
+    pieces.push_back(str.substdstr(i, 64));
+  bench.measure(label + "/concatenate", pieces.size() * 64, [&]() {
+    utf8::utf8_string s;
+    for (size_t i = 0; i < pieces.size(); ++i)
+      s += pieces[i];
+    do_not_optimize(s.length());
+  });
+}
+
+RUN_BENCH("utf8_string") {
+  const size_t chars = bench.scaled(1 << 20);
+  bench_text(bench, "utf8_string/ascii", ascii_text(chars));
+  bench_text(bench, "utf8_string/multilingual", multilingual_text(chars));
+}
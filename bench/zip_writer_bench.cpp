@@ -0,0 +1,76 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "bench.hpp"
+#include "generators.hpp"
+#include <zip_writer.hpp>
+#include <zip.h>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <sys/stat.h>
+
+using std::string;
+
+/// Pack the files the way we did before eff::zip_writer: one at a time,
+/// through libzip, which compresses each entry serially in zip_close().
+static void pack_with_libzip(const string &zipfile, const std::vector<string> &names, const string &root) {
+  int err = 0;
+  zip *z = zip_open(zipfile.c_str(), ZIP_CREATE | ZIP_TRUNCATE, &err);
+  if (!z) throw std::runtime_error("libzip couldn't create " + zipfile);
+  for (size_t i = 0; i < names.size(); ++i) {
+    zip_source_t *src = zip_source_file(z, (root + "/" + names[i]).c_str(), 0, 0);
+    if (!src || zip_file_add(z, names[i].c_str(), src, ZIP_FL_ENC_UTF_8) < 0) {
+      zip_source_free(src);
+      zip_discard(z);
+      throw std::runtime_error("libzip couldn't add " + names[i]);
+    }
+  }
+  if (zip_close(z))
+    throw std::runtime_error("libzip couldn't write " + zipfile);
+}
+
+RUN_BENCH("Packing an asset tree") {
+  scratch_dir scratch;
+  const string root = scratch / "assets";
+  const size_t file_size = 256 << 10, files = std::max<size_t>(1, (bench.pack_mb << 20) / file_size);
+  std::vector<string> names;
+  mkdir(root.c_str(), 0755);
+  for (size_t i = 0; i < files; ++i) {
+    std::stringstream dir, name;
+    dir << "group_" << i / 64;
+    name << dir.str() << "/asset_" << i << ".dat";
+    if (!(i % 64))
+      mkdir((root + "/" + dir.str()).c_str(), 0755);
+    std::ofstream((root + "/" + name.str()).c_str(), std::ios::out | std::ios::binary) << asset_bytes(file_size, i + 1);
+    names.push_back(name.str());
+  }
+  const size_t bytes = files * file_size;
+
+  bench.measure_once("libzip/serial", bytes, [&]() {
+    pack_with_libzip(scratch / "libzip.zip", names, root);
+  });
+  bench.measure_once("zip_writer/1_thread", bytes, [&]() {
+    eff::zip_writer zw(scratch / "single.zip", 1);
+    zw.add_tree(root);
+    if (!zw.close()) throw std::runtime_error("zip_writer failed");
+  });
+  bench.measure_once("zip_writer/all_threads", bytes, [&]() {
+    eff::zip_writer zw(scratch / "parallel.zip");
+    zw.add_tree(root);
+    if (!zw.close()) throw std::runtime_error("zip_writer failed");
+  });
+}
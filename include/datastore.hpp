@@ -0,0 +1,310 @@
+/**
+ * @file  datastore.hpp
+ * @brief Binary data storage for object serialization.
+ *
+ * Declares a builder and a zero-copy reader for a binary format that can be
+ * used in place from a memory-mapped file or a STORED zip entry. Nothing is
+ * parsed when a buffer is opened; each accessor reads only what it touches.
+ *
+ * @section Layout
+ * All integers are little-endian. Every reference is a 32-bit offset from the
+ * start of the buffer; offset zero is the header, so it doubles as "null".
+ *   header:  "EFFD", u16 format version, u16 schema version, u32 root, u32 size
+ *   table:   u32 vtable; fields, each aligned to its own size
+ *   vtable:  u16 vtable size, u16 table size, u16 offset of each field by id
+ *   string:  u32 bytes, u32 characters, bytes, NUL, padding to 4,
+ *            u32 byte offset of every 8th character (see utf8::utf8_view)
+ *   vector:  u32 count, then the elements, aligned to max(4, element size)
+ *
+ * @section Schema evolution
+ * Fields are identified by small integer ids rather than by position. A
+ * schema may only ever append new ids; an id that is no longer used is left
+ * deprecated, never recycled. Readers get the default for any field that the
+ * writer didn't know about (its vtable is too short) or left at its default
+ * (its vtable slot is zero), and ignore ids they don't know about. The header
+ * carries a schema version for anything a table can't express on its own.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#ifndef e_DATASTORE_H
+#define e_DATASTORE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "utf8_string.hpp"
+
+namespace eff {
+  using std::string;
+
+  /// Raw loads and stores; the format is never read through a cast pointer,
+  /// so mappings need not be aligned, and big-endian hosts swap on access.
+  namespace data_detail {
+    inline bool host_is_little() {
+      const uint16_t probe = 1;
+      return *(const unsigned char*) &probe;
+    }
+    template<class T> inline T load(const char *p) {
+      T v;
+      if (host_is_little())
+        memcpy(&v, p, sizeof v);
+      else for (size_t i = 0; i < sizeof v; ++i)
+        ((char*) &v)[i] = p[sizeof v - 1 - i];
+      return v;
+    }
+    template<class T> inline void store(char *p, T v) {
+      if (host_is_little())
+        memcpy(p, &v, sizeof v);
+      else for (size_t i = 0; i < sizeof v; ++i)
+        p[i] = ((const char*) &v)[sizeof v - 1 - i];
+    }
+
+    enum {
+      HEADER_SIZE = 16,
+      FORMAT_VERSION = 1
+    };
+  }
+
+  /// A view of a string stored in a data buffer.
+  class data_string {
+    const char *str_;
+    uint32_t bytes_, chars_;
+    const char *index_;
+
+    public:
+    data_string(): str_(""), bytes_(0), chars_(0), index_(NULL) {}
+    data_string(const char *s, uint32_t b, uint32_t c, const char *i):
+        str_(s), bytes_(b), chars_(c), index_(i) {}
+
+    /// The bytes, which are NUL-terminated in the buffer.
+    const char *c_str()  const { return str_; }
+    size_t size()        const { return bytes_; }
+    size_t length()      const { return chars_; }
+    bool empty()         const { return !bytes_; }
+    string str()         const { return string(str_, bytes_); }
+
+    /// View the string with its stored index; no character is scanned.
+    utf8::utf8_view view() const { return utf8::utf8_view(str_, bytes_, index_, chars_); }
+
+    bool operator==(const string &s) const { return s.size() == bytes_ && !memcmp(s.data(), str_, bytes_); }
+    bool operator!=(const string &s) const { return !(*this == s); }
+  };
+
+  /// A view of a vector of scalars stored in a data buffer.
+  template<class T> class data_vector {
+    const char *elems;
+    uint32_t count;
+
+    public:
+    data_vector(): elems(NULL), count(0) {}
+    data_vector(const char *e, uint32_t c): elems(e), count(c) {}
+
+    size_t size() const { return count; }
+    bool empty()  const { return !count; }
+    T operator[](size_t i) const { return data_detail::load<T>(elems + i * sizeof(T)); }
+    T at(size_t i) const {
+      if (i >= count)
+        throw std::range_error("eff::data_vector::at(): index out of bounds");
+      return (*this)[i];
+    }
+
+    /// Returns the elements in place, or NULL if they can't be used that way
+    /// because the buffer isn't suitably aligned or isn't in host byte order.
+    const T *data() const {
+      return (data_detail::host_is_little() && !((uintptr_t) elems % sizeof(T)))?
+          (const T*) (const void*) elems : NULL;
+    }
+  };
+
+  class data_table;
+
+  /// A view of a vector of tables or strings stored in a data buffer.
+  class data_ref_vector {
+    const char *base;
+    size_t len;
+    uint32_t pos;
+    uint32_t count;
+
+    uint32_t ref(size_t i) const;
+
+    public:
+    data_ref_vector(): base(NULL), len(0), pos(0), count(0) {}
+    data_ref_vector(const char *b, size_t l, uint32_t p, uint32_t c): base(b), len(l), pos(p), count(c) {}
+
+    size_t size() const { return count; }
+    bool empty()  const { return !count; }
+    data_table get_table(size_t i) const;
+    data_string get_string(size_t i) const;
+  };
+
+  /**
+   * A view of one table in a data buffer. Looking up a field costs two loads
+   * from the vtable; nothing else in the buffer is read.
+   */
+  class data_table {
+    const char *base;
+    size_t len;
+    uint32_t pos;
+    uint32_t vtable;
+    uint16_t vtable_size;
+
+    uint32_t field_pos(uint16_t id) const;
+    uint32_t field_ref(uint16_t id) const;
+
+    public:
+    data_table(): base(NULL), len(0), pos(0), vtable(0), vtable_size(0) {}
+    data_table(const char *b, size_t l, uint32_t p);
+
+    /// Whether this table exists in the buffer.
+    bool good() const { return base; }
+    /// Whether the given field was written (and not left at its default).
+    bool has(uint16_t id) const { return field_pos(id); }
+
+    template<class T> T get(uint16_t id, T def = T()) const {
+      uint32_t at = field_pos(id);
+      if (!at) return def;
+      if (at + sizeof(T) > len)
+        throw std::range_error("eff::data_table::get(): field out of bounds");
+      return data_detail::load<T>(base + at);
+    }
+    data_string get_string(uint16_t id) const;
+    data_table get_table(uint16_t id) const;
+    data_ref_vector get_refs(uint16_t id) const;
+
+    template<class T> data_vector<T> get_vector(uint16_t id) const {
+      uint32_t at = field_ref(id);
+      if (!at) return data_vector<T>();
+      uint32_t count = data_detail::load<uint32_t>(base + at);
+      if (at + 4 + (uint64_t) count * sizeof(T) > len)
+        throw std::range_error("eff::data_table::get_vector(): vector out of bounds");
+      return data_vector<T>(base + at + 4, count);
+    }
+
+    friend class data_ref_vector;
+    friend class data_reader;
+  };
+
+  /// Reads a data buffer in place. The buffer must outlive every view.
+  class data_reader {
+    const char *base;
+    size_t len;
+
+    public:
+    data_reader(): base(NULL), len(0) {}
+    data_reader(const void *data, size_t size);
+
+    /// Whether the buffer holds a well-formed header.
+    bool good() const { return base; }
+    uint16_t schema_version() const;
+    data_table root() const;
+  };
+
+  /// A read-only mapping of a data file, or of a STORED entry in a zip file.
+  class data_file {
+    void *map;
+    size_t map_size;
+    const char *start;
+    size_t size;
+
+    bool map_file(const string &path);
+
+    data_file(const data_file&);
+    data_file& operator=(const data_file&);
+
+    public:
+    /// Map a whole file.
+    explicit data_file(const string &path);
+    /// Map a zip file and find the given STORED entry within it.
+    data_file(const string &zipfile, const string &entry);
+    ~data_file();
+
+    bool good() const { return start; }
+    data_reader reader() const { return data_reader(start, size); }
+  };
+
+  /**
+   * Writes a data buffer. Children are written before the tables that refer
+   * to them; a table is written between start_table() and end_table(), and no
+   * other object may be added while a table is open.
+   */
+  class data_builder {
+    public:
+    typedef uint32_t ref;
+
+    private:
+    struct pending_field {
+      uint16_t id;
+      uint16_t size;
+      char bytes[8];
+    };
+    string buf;
+    std::vector<pending_field> fields;
+    std::map<string, uint32_t> vtables;
+    bool in_table;
+
+    void align(size_t n);
+    void not_in_table(const char *who) const;
+    void add_field(uint16_t id, const void *v, uint16_t size);
+
+    public:
+    explicit data_builder(uint16_t schema_version = 0);
+
+    ref add_string(const string &str);
+    ref add_refs(const std::vector<ref> &refs);
+    template<class T> ref add_vector(const T *elems, size_t count) {
+      not_in_table("add_vector");
+      align(sizeof(T) > 4? sizeof(T) : 4);
+      if (sizeof(T) > 4) {
+        buf.append(sizeof(T) - 4, '\0');
+      }
+      ref res = buf.size();
+      char b[4];
+      data_detail::store<uint32_t>(b, count);
+      buf.append(b, 4);
+      for (size_t i = 0; i < count; ++i) {
+        char e[sizeof(T)];
+        data_detail::store<T>(e, elems[i]);
+        buf.append(e, sizeof(T));
+      }
+      return res;
+    }
+    template<class T> ref add_vector(const std::vector<T> &elems) {
+      return add_vector(elems.empty()? NULL : &elems[0], elems.size());
+    }
+
+    void start_table();
+    /// Add a scalar field to the open table. Fields equal to their default
+    /// should simply be left out; readers will supply the default.
+    template<class T> void field(uint16_t id, T value) {
+      add_field(id, &value, sizeof value);
+    }
+    /// Add a reference to a string, vector or table to the open table.
+    void field_ref(uint16_t id, ref r) {
+      if (r) field<uint32_t>(id, r);
+    }
+    ref end_table();
+
+    /// Set the root table and return the finished buffer.
+    const string &finish(ref root);
+  };
+}
+
+#endif
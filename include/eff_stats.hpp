@@ -0,0 +1,174 @@
+/**
+ * @file  eff_stats.hpp
+ * @brief Opt-in instrumentation counters.
+ *
+ * Declares counters for the work done by directory kernels and utf8_string:
+ * system calls, entries listed, bytes decompressed, cache hits and misses,
+ * heap allocations, and time spent in the expensive paths. Counting is only
+ * compiled in when EFF_INSTRUMENT is defined (`make INSTRUMENT=1`); otherwise
+ * every counter reads zero and the counting macros expand to nothing.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#ifndef e_EFF_STATS_H
+#define e_EFF_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace eff {
+  enum stat_id {
+    STAT_SYSCALLS,           ///< System calls made directly (opendir, readdir, mmap...)
+    STAT_ENTRIES_LISTED,     ///< Directory or archive entries read from their source
+    STAT_BYTES_DECOMPRESSED, ///< Bytes inflated out of archives
+    STAT_CACHE_HITS,         ///< Listings or nested archives served from memory
+    STAT_CACHE_MISSES,       ///< Listings or nested archives that had to be read
+    STAT_ALLOCATIONS,        ///< Calls to operator new
+    STAT_NS_LIST_DIRECTORY,  ///< Nanoseconds spent reading directories from disk
+    STAT_NS_OPEN_ZIP,        ///< Nanoseconds spent opening and indexing zip archives
+    STAT_NS_BUILD_INDEX,     ///< Nanoseconds spent indexing utf8_string characters
+    STAT_COUNT
+  };
+
+  /// A snapshot of every counter.
+  struct stats {
+    uint64_t value[STAT_COUNT];
+
+    stats() { for (int i = 0; i < STAT_COUNT; ++i) value[i] = 0; }
+    uint64_t operator[](stat_id id) const { return value[id]; }
+    stats &operator+=(const stats &s) {
+      for (int i = 0; i < STAT_COUNT; ++i) value[i] += s.value[i];
+      return *this;
+    }
+    /// The counts between an earlier snapshot and this one.
+    stats operator-(const stats &s) const {
+      stats res(*this);
+      for (int i = 0; i < STAT_COUNT; ++i) res.value[i] -= s.value[i];
+      return res;
+    }
+
+    /// A short name for the given counter, such as "syscalls".
+    static const char *name(stat_id id);
+  };
+
+  /// Whether this build counts anything at all.
+  inline bool stats_enabled() {
+#   ifdef EFF_INSTRUMENT
+      return true;
+#   else
+      return false;
+#   endif
+  }
+
+  /// The sum of the counters of every thread, past and present.
+  stats global_statistics();
+
+  namespace stats_detail {
+    /// Counters readable from any thread. A handle's may be charged from
+    /// several threads at once, so add() is atomic; a thread's own counters
+    /// use add_owned(), whose relaxed load and store need no locked
+    /// instruction but are only correct with a single writer.
+    struct counter_block {
+      std::atomic<uint64_t> value[STAT_COUNT];
+
+      counter_block() { for (int i = 0; i < STAT_COUNT; ++i) value[i].store(0, std::memory_order_relaxed); }
+      void add(stat_id id, uint64_t n) {
+        value[id].fetch_add(n, std::memory_order_relaxed);
+      }
+      void add_owned(stat_id id, uint64_t n) {
+        value[id].store(value[id].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+      }
+      void add(const stats &s) {
+        for (int i = 0; i < STAT_COUNT; ++i) add(stat_id(i), s.value[i]);
+      }
+      stats snapshot() const {
+        stats res;
+        for (int i = 0; i < STAT_COUNT; ++i) res.value[i] = value[i].load(std::memory_order_relaxed);
+        return res;
+      }
+
+      private:
+      counter_block(const counter_block&);
+      counter_block &operator=(const counter_block&);
+    };
+
+    /// The calling thread's counters, or NULL once they're destroyed at exit.
+    counter_block *thread_block();
+    /// Counters shared by threads whose own are already destroyed.
+    counter_block &orphan_block();
+    struct handle_scope;
+    /// The innermost handle whose operation this thread is running, if any.
+    handle_scope *&charged_scope();
+
+    /// Charges everything counted during its lifetime to a handle as well.
+    /// Scopes nest: an operation one handle runs through another, as an
+    /// overlay does through its layers, is charged to both.
+    struct handle_scope {
+      counter_block *block; ///< NULL if an outer scope already charges it
+      handle_scope *outer;
+      handle_scope(counter_block &b): block(&b), outer(charged_scope()) {
+        for (handle_scope *s = outer; s; s = s->outer)
+          if (s->block == &b) {
+            block = NULL;
+            return;
+          }
+        charged_scope() = this;
+      }
+      ~handle_scope() {
+        if (block)
+          charged_scope() = outer;
+      }
+
+      private:
+      handle_scope(const handle_scope&);
+      handle_scope &operator=(const handle_scope&);
+    };
+
+    inline void count(stat_id id, uint64_t n) {
+      if (counter_block *own = thread_block())
+        own->add_owned(id, n);
+      else
+        orphan_block().add(id, n);
+      for (handle_scope *s = charged_scope(); s; s = s->outer)
+        s->block->add(id, n);
+    }
+
+    /// Counts the nanoseconds elapsed during its lifetime.
+    struct timer {
+      stat_id id;
+      std::chrono::steady_clock::time_point start;
+      timer(stat_id i): id(i), start(std::chrono::steady_clock::now()) {}
+      ~timer() {
+        count(id, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+      }
+    };
+  }
+}
+
+#ifdef EFF_INSTRUMENT
+#  define EFF_COUNT(id, n) ::eff::stats_detail::count(::eff::id, n)
+#  define EFF_TIME(id) ::eff::stats_detail::timer eff_timer_##id(::eff::id)
+#  define EFF_CHARGE(block) ::eff::stats_detail::handle_scope eff_charge_scope(block)
+#else
+#  define EFF_COUNT(id, n) ((void) 0)
+#  define EFF_TIME(id)
+#  define EFF_CHARGE(block)
+#endif
+
+#endif
@@ -25,15 +25,158 @@
 #define e_GDIR_H
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <memory_resource>
+#include <stdint.h>
+#include "eff_stats.hpp"
 
 /// The ENIGMA File Functions namespace
 namespace eff {
   using std::string;
   
+  enum entry_type {
+    ENTRY_FILE,
+    ENTRY_DIRECTORY
+  };
+  
+  /// How a directory matches the names it's asked to look up.
+  enum lookup_mode {
+    LOOKUP_EXACT,  ///< Byte for byte
+    LOOKUP_FOLDED  ///< Ignoring case and Unicode composition; see utf8::fold_key
+  };
+  
+  /// What's known about a file without opening it. For zip entries, this
+  /// comes from the central directory, read once when the archive opens.
+  struct entry_info {
+    enum {
+      HAS_SIZE            = 1,
+      HAS_COMPRESSED_SIZE = 2,
+      HAS_CRC             = 4,
+      HAS_MTIME           = 8,
+      HAS_METHOD          = 16
+    };
+    uint64_t size;
+    uint64_t compressed_size; ///< The size as stored; for files on disk, the same as size
+    int64_t mtime;            ///< Seconds since the epoch
+    uint32_t crc;             ///< The CRC-32 of the contents
+    uint16_t method;          ///< The zip compression method; 0 (STORED) on disk
+    uint16_t valid;           ///< Which of the above are known, as HAS_ flags
+    
+    entry_info(): size(0), compressed_size(0), mtime(0), crc(0), method(0), valid(0) {}
+  };
+  
+  /// A directory entry as filled in by a batch. The name points into the
+  /// directory's own storage; it stays valid until the handle that listed it
+  /// enters, leaves or refreshes, or is destroyed.
+  struct entry_view {
+    const char *name; ///< NUL-terminated, though names may contain NULs
+    size_t length;
+    entry_type type;
+    size_t index;     ///< The entry's index in its zip archive, or no_index
+    /// The entry's metadata, where the directory already has it in memory
+    /// (as for zip entries); NULL where it would take a call to stat().
+    const entry_info *info;
+    
+    static const size_t no_index = size_t(-1);
+    
+    entry_view(): name(""), length(0), type(ENTRY_FILE), index(no_index), info(NULL) {}
+    entry_view(std::string_view n, entry_type t, size_t i = no_index, const entry_info *inf = NULL):
+        name(n.data()), length(n.size()), type(t), index(i), info(inf) {}
+    string str() const { return string(name, length); }
+  };
+  
+  /// Receives the contents of a file as it's read, a block at a time.
+  class content_sink {
+    public:
+    /// @return Return false to stop reading.
+    virtual bool consume(const char *data, size_t size) = 0;
+    virtual ~content_sink() {}
+  };
+  
+  /// Receives the entries of a directory as a backend lists them.
+  class listing_sink {
+    public:
+    virtual void add(const char *name, bool directory) = 0;
+    virtual ~listing_sink() {}
+  };
+  
+  /// Where dirent() reads directories and files from: the host's file system,
+  /// or something standing in for it, such as a memory_backend. Paths are
+  /// those given to dirent(), with names appended after a '/' ('\\' on
+  /// Windows). Calls may come from several threads at once.
+  class fs_backend {
+    public:
+    /// List a directory's entries, other than "." and "..", in any order.
+    /// @return Return false if there's no directory there to read.
+    virtual bool list(const string &path, listing_sink &sink) const = 0;
+    /// Fill in what's known about a file; return false if it can't be found.
+    virtual bool stat(const string &path, entry_info &info) const = 0;
+    /// Stream a file to the sink; return false unless it's read whole.
+    virtual bool read(const string &path, content_sink &sink) const = 0;
+    virtual ~fs_backend() {}
+    
+    /// The host's file system, which dirent() uses by default.
+    static const fs_backend &native();
+  };
+  
+  namespace listing_detail {
+    /// One directory level's names, keyed by utf8::fold_key, for kernels
+    /// looking names up with LOOKUP_FOLDED. Where several names fold alike,
+    /// the first added wins.
+    struct folded_names {
+      typedef std::unordered_map<string, std::string_view> table;
+      table files, dirs;
+      
+      /// Add a name; it must outlive this index.
+      static void add(table &t, std::string_view name);
+      /// The name folding like the given one, or the given one if none does.
+      static std::string_view find(const table &t, const string &name);
+    };
+    
+    /// One directory level's entries, laid out for directory::for_each_file().
+    struct entry_array {
+      std::vector<entry_view> files, dirs;
+    };
+    
+    /// Holds something derived from an immutable listing, built the first
+    /// time any thread asks for it. Copies start out empty.
+    template<class T> class lazy_slot {
+      mutable std::atomic<T*> value;
+      
+      public:
+      lazy_slot(): value(NULL) {}
+      lazy_slot(const lazy_slot&): value(NULL) {}
+      lazy_slot &operator=(const lazy_slot&) { delete value.exchange(NULL); return *this; }
+      ~lazy_slot() { delete value.load(); }
+      
+      /// Return the value, calling build(T&) to fill it in if there isn't
+      /// one yet. Threads that race both build; one value wins.
+      template<class F> const T &get(F build) const {
+        T *res = value.load(std::memory_order_acquire);
+        if (res)
+          return *res;
+        res = new T();
+        build(*res);
+        T *expected = NULL;
+        if (value.compare_exchange_strong(expected, res, std::memory_order_acq_rel))
+          return *res;
+        delete res;
+        return *expected;
+      }
+    };
+  }
+  
   /* ******************************************************************************************* *\
   |* This part's a little ugly. We declare an interface, then just go ahead and write functions  *|
   |* that delegate to it. The idea is to keep the interface's workings internal; you don't have  *|
   |* to allocate or delete anything, because this directory object handles it for you.           *|
+  |*                                                                                             *|
+  |* Each handle owns its kernel, and so its own position. What kernels share -- listings, the   *|
+  |* parsed tree of a zip file -- is immutable once built, and reference counted atomically. A   *|
+  |* single handle isn't safe to use from two threads at once, but copies of it are.             *|
   \* ******************************************************************************************* */
   
   class directory {
@@ -43,65 +186,222 @@ namespace eff {
       virtual string first_directory() = 0;
       virtual string next_file() = 0;
       virtual string next_directory() = 0;
+      virtual void rewind_files() = 0;
+      virtual void rewind_directories() = 0;
+      virtual size_t next_files(entry_view *out, size_t max) = 0;
+      virtual size_t next_directories(entry_view *out, size_t max) = 0;
+      /// Every entry of the current level, as an array kept with the listing.
+      virtual const listing_detail::entry_array &entries() const = 0;
       virtual size_t file_count() const = 0;
       virtual size_t directory_count() const = 0;
       virtual bool enter(string dname) = 0;
       virtual directory_kernel *enter_new(string dname) const = 0;
       virtual bool leave() = 0;
+      virtual bool has_file(string fname) const = 0;
+      virtual bool stat(string fname, entry_info &info) const = 0;
+      virtual bool read_file(string fname, content_sink &sink) const = 0;
+      virtual bool refresh() = 0;
+      /// Copy this kernel's position, sharing everything else.
+      virtual directory_kernel *clone() const = 0;
       virtual ~directory_kernel() {}
+      
+      /// What this handle's operations have cost; see eff_stats.hpp.
+      stats_detail::counter_block counters;
+      /// How enter(), has_file(), stat() and read_file() match names.
+      lookup_mode lookup;
+      
+      directory_kernel(): counters(), lookup(LOOKUP_EXACT) {}
     } *kernel;
-    size_t *krefs;
+    
+    template<class F> static inline void visit(const std::vector<entry_view> &entries, F &f) {
+      for (const entry_view *e = entries.data(), *end = e + entries.size(); e != end; ++e)
+        f(*e);
+    }
+    
+    /// Give a kernel entered or cloned from ours our lookup mode.
+    inline directory_kernel *inherit(directory_kernel *k) const {
+      if (k)
+        k->lookup = kernel->lookup;
+      return k;
+    }
     
     /// Construct from a kernel; this is only available to our children
-    inline directory(directory_kernel* k): kernel(k), krefs(new size_t(1)) {}
+    inline directory(directory_kernel* k): kernel(k) {}
     inline static directory ctor(directory_kernel* k) { return k; }
     
-    inline void unref() {
-      if (!--*krefs) {
-        delete kernel;
-        delete krefs;
-      }
+    /// Construct from the kernel returned by the given function, charging
+    /// the work of opening it to the new kernel's counters.
+    template<class F> static directory ctor_charged(F open) {
+#     ifdef EFF_INSTRUMENT
+        stats_detail::counter_block opening;
+        directory_kernel *k;
+        {
+          EFF_CHARGE(opening);
+          k = open();
+        }
+        if (k)
+          k->counters.add(opening.snapshot());
+        return k;
+#     else
+        return open();
+#     endif
     }
     
     public:
       
-      /// Construct from another directory, maintaining reference count
-      inline directory(const directory &d):
-          kernel(d.kernel), krefs(d.krefs) {
-        ++*d.krefs;
+      /// Construct from another directory, at the same position in the
+      /// same tree; from there, the two move independently.
+      inline directory(const directory &d): kernel(d.kernel? d.inherit(d.kernel->clone()) : NULL) {}
+      inline directory(directory &&d): kernel(d.kernel) { d.kernel = NULL; }
+      
+      inline string first_file()      { EFF_CHARGE(kernel->counters); return kernel->first_file(); }
+      inline string first_directory() { EFF_CHARGE(kernel->counters); return kernel->first_directory(); }
+      inline string next_file()       { EFF_CHARGE(kernel->counters); return kernel->next_file(); }
+      inline string next_directory()  { EFF_CHARGE(kernel->counters); return kernel->next_directory(); }
+      
+      /// Restart iteration without fetching anything, for use with batches.
+      inline void rewind_files()       { kernel->rewind_files(); }
+      inline void rewind_directories() { kernel->rewind_directories(); }
+      
+      /// Fill the given buffer with up to max of the following entries, in
+      /// the same order and from the same position as next_file() would.
+      /// Unlike next_file(), nothing is copied, and an empty name isn't
+      /// mistaken for the end.
+      /// @return Returns the number of entries filled in; zero at the end.
+      inline size_t next_files(entry_view *out, size_t max) {
+        EFF_CHARGE(kernel->counters);
+        return kernel->next_files(out, max);
+      }
+      inline size_t next_directories(entry_view *out, size_t max) {
+        EFF_CHARGE(kernel->counters);
+        return kernel->next_directories(out, max);
+      }
+      template<size_t n> inline size_t next_files(entry_view (&out)[n]) { return next_files(out, n); }
+      template<size_t n> inline size_t next_directories(entry_view (&out)[n]) { return next_directories(out, n); }
+      
+      /// Call f(const entry_view&) for each file in this directory, in the
+      /// order next_file() lists them, without moving this directory's
+      /// iterators. This makes one virtual call for the whole level; the
+      /// loop over its entries is inlined with f. The array is built the
+      /// first time any handle visits the level, then shared.
+      template<class F> inline void for_each_file(F f) const {
+        EFF_CHARGE(kernel->counters);
+        visit(kernel->entries().files, f);
+      }
+      template<class F> inline void for_each_directory(F f) const {
+        EFF_CHARGE(kernel->counters);
+        visit(kernel->entries().dirs, f);
       }
       
-      inline string first_file()      { return kernel->first_file(); }
-      inline string first_directory() { return kernel->first_directory(); }
-      inline string next_file()       { return kernel->next_file(); }
-      inline string next_directory()  { return kernel->next_directory(); }
       inline size_t file_count()      { return kernel->file_count(); }
       inline size_t directory_count() { return kernel->directory_count(); }
       
       /// Enter the subdirectory with the given name.
       /// @return Returns true if successful, false otherwise.
-      inline bool enter(string dname) { return kernel->enter(dname); }
+      inline bool enter(string dname) { EFF_CHARGE(kernel->counters); return kernel->enter(dname); }
       
       inline bool is_open() const { return kernel; }
       inline bool good()    const { return kernel; }
       
-      inline directory enter_new(string dname) { return kernel->enter_new(dname); }
+      inline directory enter_new(string dname) { EFF_CHARGE(kernel->counters); return inherit(kernel->enter_new(dname)); }
       
-      inline bool leave() { return kernel->leave(); }
-      inline ~directory() { unref(); }
+      inline bool leave() { EFF_CHARGE(kernel->counters); return kernel->leave(); }
+      
+      /// Check whether a file with the given name exists in this directory,
+      /// without iterating it.
+      inline bool has_file(string fname) const { EFF_CHARGE(kernel->counters); return kernel->has_file(fname); }
+      
+      /// Look up the size, CRC, modification time and so on of a file in
+      /// this directory. Zip archives answer from memory.
+      /// @return Returns true if the file exists, false otherwise.
+      inline bool stat(string fname, entry_info &info) const {
+        EFF_CHARGE(kernel->counters);
+        return kernel->stat(fname, info);
+      }
+      
+      /// Read a file in this directory from start to end, handing each block
+      /// to the given sink; zip entries are decompressed as they're read.
+      /// @return Returns true if the whole file was read, false otherwise.
+      inline bool read_file(string fname, content_sink &sink) const {
+        EFF_CHARGE(kernel->counters);
+        return kernel->read_file(fname, sink);
+      }
+      
+      /// Choose how enter(), enter_new(), has_file(), stat() and read_file()
+      /// match the names they're given. With LOOKUP_FOLDED, an exact match
+      /// is still preferred; failing that, each level builds an index of its
+      /// folded names on first use, so lookups stay constant time. Copies
+      /// of this handle, and directories entered from it, inherit the mode.
+      inline void set_lookup(lookup_mode mode) { kernel->lookup = mode; }
+      inline lookup_mode get_lookup() const { return kernel->lookup; }
+      
+      /// Re-read the listing of this directory from its source. Iteration
+      /// restarts if anything changed.
+      /// @return Returns true if the listing changed, false otherwise.
+      inline bool refresh() { EFF_CHARGE(kernel->counters); return kernel->refresh(); }
+      
+      /// What this handle's operations, including opening it, have cost so
+      /// far. Copies of a handle count from zero. All zero unless built with
+      /// EFF_INSTRUMENT.
+      inline stats statistics() const { return kernel? kernel->counters.snapshot() : stats(); }
+      
+      inline ~directory() { delete kernel; }
       
       inline directory& operator= (const directory& dir) {
-        if (kernel)
-          unref();
-        ++*dir.krefs;
-        kernel = dir.kernel;
-        krefs = dir.krefs;
+        directory_kernel *k = dir.kernel? dir.inherit(dir.kernel->clone()) : NULL;
+        delete kernel;
+        kernel = k;
+        return *this;
+      }
+      inline directory& operator= (directory&& dir) {
+        std::swap(kernel, dir.kernel);
         return *this;
       }
   };
 
+  /// How far ahead of a walk to list subdirectories on disk; see dirent().
+  struct prefetch_options {
+    unsigned fanout;  ///< How many subdirectories of each listed directory to list ahead
+    unsigned depth;   ///< How many levels below a listed directory to list ahead
+    unsigned workers; ///< How many threads list them
+    explicit prefetch_options(unsigned fanout = 8, unsigned depth = 1, unsigned workers = 4);
+  };
+  
   directory dirent_zip(string zipfile);
   directory dirent(string dname);
+  
+  /// Open a zip file or directory, allocating its parsed tree or listings,
+  /// and the names in them, from the given memory resource rather than the
+  /// global heap. With a std::pmr::monotonic_buffer_resource, a whole mounted
+  /// tree can be released in one go once its handles are gone. Allocations
+  /// from one mount are serialized, so the resource needn't be thread-safe
+  /// unless it's shared with other mounts or other code. It must outlive
+  /// every handle on the tree.
+  directory dirent_zip(string zipfile, std::pmr::memory_resource *memory);
+  directory dirent(string dname, std::pmr::memory_resource *memory);
+  
+  /// Open a directory on disk whose subdirectories are listed ahead of time
+  /// by a pool of threads, so walking it doesn't wait on each one in turn.
+  /// Whenever a directory is listed, its first few subdirectories are queued;
+  /// entering one takes its listing if it's ready, waits for it if it's being
+  /// read, and otherwise reads it as usual. Iteration is unaffected.
+  directory dirent(string dname, const prefetch_options &prefetch, std::pmr::memory_resource *memory = NULL);
+  
+  /// Open a directory from the given backend rather than the host's file
+  /// system; prefetching and memory work as above. The backend must outlive
+  /// every handle on the tree.
+  directory dirent(string dname, const fs_backend &backend, std::pmr::memory_resource *memory = NULL);
+  directory dirent(string dname, const fs_backend &backend, const prefetch_options &prefetch,
+                   std::pmr::memory_resource *memory = NULL);
+  
+  /// Set how much memory may hold decompressed zip files that were entered
+  /// from inside other zip files, for reuse when they're entered again.
+  /// STORED inner archives are read in place and don't count against this.
+  void set_nested_archive_budget(size_t bytes);
+  
+  /// Present several directories as one tree. Where layers have entries of
+  /// the same name, the layer listed first wins; each name appears only once.
+  directory dirent_overlay(const std::vector<directory> &layers);
 }
 
 #endif
@@ -0,0 +1,74 @@
+/**
+ * @file  gdir_diff.hpp
+ * @brief Comparison of directory trees.
+ *
+ * Declares a function listing the entries added, removed and modified
+ * between two directories of any kind, such as a project folder and the
+ * zip file it was packed into.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#ifndef e_GDIR_DIFF_H
+#define e_GDIR_DIFF_H
+
+#include "gdir.hpp"
+#include <vector>
+
+namespace eff {
+  struct diff_options {
+    /// Treat files of the same size and modification time as unchanged,
+    /// without reading them.
+    bool trust_mtime;
+    /// How far apart two modification times may be and still count as the
+    /// same; zip files only store them to two seconds.
+    int64_t mtime_slack;
+    /// When nothing cheaper can tell, compare contents by CRC-32. If this
+    /// is off, such files are reported as modified.
+    bool compare_contents;
+    /// How many threads read contents; zero uses one per hardware thread.
+    unsigned threads;
+    diff_options();
+  };
+
+  struct diff_entry {
+    enum change {
+      ADDED,    ///< Only in the second directory
+      REMOVED,  ///< Only in the first directory
+      MODIFIED  ///< In both, with different contents
+    };
+    string path;     ///< Relative to the directories compared, separated by '/'
+    change kind;
+    entry_type type; ///< Directories are reported once, not with their contents
+  };
+
+  struct diff_result {
+    std::vector<diff_entry> changes; ///< Sorted by path
+    size_t files_compared;           ///< Files present in both directories
+    size_t files_read;               ///< Of those, how many had to have contents read
+    bool complete;                   ///< False if some file couldn't be read
+
+    bool empty() const { return changes.empty(); }
+  };
+
+  /// Compare two directories from their current positions. Files are compared
+  /// from the cheapest test to the most expensive: size, then modification
+  /// time, then the CRC-32 a zip file stores, and only then the contents,
+  /// read on several threads at once.
+  diff_result diff(const directory &a, const directory &b, const diff_options &options = diff_options());
+}
+
+#endif
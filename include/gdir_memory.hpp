@@ -0,0 +1,93 @@
+/**
+ * @file  gdir_memory.hpp
+ * @brief A directory tree held in memory, for dirent() to read.
+ *
+ * Declares an fs_backend serving files and directories from memory, which
+ * can be made to answer as slowly as a disk or a network share would, so
+ * that walking, caching and prefetching can be measured apart from I/O.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#ifndef e_GDIR_MEMORY_H
+#define e_GDIR_MEMORY_H
+
+#include "gdir.hpp"
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+namespace eff {
+  /// Files and directories held in memory. Paths are split at '/' and '\\',
+  /// and empty parts and "." are ignored, so "", "/" and "." all name the
+  /// root. The tree can be changed while it's mounted; handles see changes
+  /// when they refresh(), as they would on disk.
+  class memory_backend: public fs_backend {
+    typedef std::shared_ptr<const string> contents_ptr;
+    struct file_node {
+      contents_ptr contents;
+      int64_t mtime;
+    };
+    struct dir_node {
+      std::map<string, file_node> files;
+      std::set<string> dirs;
+    };
+
+    mutable std::mutex mtx;
+    std::map<string, dir_node> tree; ///< Every directory, by normalized path
+    std::chrono::nanoseconds list_latency, stat_latency, read_latency;
+    mutable std::atomic<size_t> lists, stats, reads;
+
+    static string normalize(const string &path);
+    dir_node &make_directory(const string &path); ///< The caller holds the lock
+    bool remove_entry(const string &path);        ///< The caller holds the lock
+
+    public:
+    memory_backend();
+
+    /// Add a file, and any directories above it, replacing what was there.
+    void add_file(const string &path, const string &contents = string());
+    /// Add a directory, and any above it.
+    void add_directory(const string &path);
+    /// Remove a file, or a directory with everything in it.
+    bool remove(const string &path);
+
+    /// Make each call of the given kind wait this long before answering, as
+    /// a disk would; concurrent calls wait side by side. Waits are only as
+    /// precise as the system's sleep, typically within 100 microseconds.
+    void set_latency(std::chrono::nanoseconds list, std::chrono::nanoseconds stat = std::chrono::nanoseconds(0),
+                     std::chrono::nanoseconds read = std::chrono::nanoseconds(0));
+
+    /// How many calls of each kind have been made, for checking how often
+    /// a walk reads each directory.
+    size_t list_calls() const { return lists.load(); }
+    size_t stat_calls() const { return stats.load(); }
+    size_t read_calls() const { return reads.load(); }
+
+    bool list(const string &path, listing_sink &sink) const;
+    bool stat(const string &path, entry_info &info) const;
+    bool read(const string &path, content_sink &sink) const;
+
+    private:
+      memory_backend(const memory_backend&);
+      memory_backend &operator=(const memory_backend&);
+  };
+}
+
+#endif
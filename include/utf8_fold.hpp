@@ -0,0 +1,45 @@
+/**
+ * @file  utf8_fold.hpp
+ * @brief Case- and composition-insensitive keys for UTF-8 names.
+ *
+ * Declares a function reducing a UTF-8 name to a key that is the same for
+ * every spelling of it differing only in letter case, or in whether accents
+ * are composed into their letters (as Windows and Linux usually write them)
+ * or follow them as combining marks (as macOS usually does).
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#ifndef e_UTF8_FOLD_H
+#define e_UTF8_FOLD_H
+
+#include <string>
+
+namespace utf8 {
+
+/**
+ * Returns the given name case-folded and in Normalization Form C. Names made
+ * only of ASCII are just lowercased, without being decoded. Otherwise, case
+ * folding covers Latin, Greek and Cyrillic, and composition covers the
+ * accented letters of those scripts; other characters are kept as they are.
+ * A name that isn't valid UTF-8 only has its ASCII letters lowercased.
+ */
+std::string fold_key(const char *name, size_t length);
+inline std::string fold_key(const std::string &name) { return fold_key(name.data(), name.size()); }
+
+}
+
+#endif
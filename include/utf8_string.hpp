@@ -25,12 +25,24 @@
 #define e_UTF8_STRING_H
 
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
 
 #define UTF8S_NOEXCEPT
 #define UTF8S_CPP11 0
 
+#ifdef EFF_INSTRUMENT
+#  include "eff_stats.hpp"
+#  define UTF8S_TIME(id) EFF_TIME(id)
+#else
+#  define UTF8S_TIME(id)
+#endif
+
 
 namespace utf8 {
 
@@ -47,10 +59,130 @@ inline bool utf8_is_fragment(char c) {
   return (c & 0xC0) == 0x80;
 }
 
-class utf8_string {
-  std::string data;
-  std::basic_string<size_t> nthcharat;
+inline char utf8_mask_for(char c) {
+  return 
+      "\x1F\x1F\x1F\x1F\x1F\x1F\x1F\x1F" "\x1F\x1F\x1F\x1F\x1F\x1F\x1F\x1F"
+      "\x0F\x0F\x0F\x0F\x0F\x0F\x0F\x0F" "\x07\x07\x07\x07\x03\x03\x01"
+      [(c & 0x3E) >> 1]; // 0x3E = 0b00111110
+}
+inline int utf8_length_of(char c) {
+  return
+      "\2\2\2\2\2\2\2\2" "\2\2\2\2\2\2\2\2"
+      "\3\3\3\3\3\3\3\3" "\4\4\4\4\5\5\6\1"
+      [(c & 0x3E) >> 1]; // 0x3E = 0b00111110
+}
+
+/// Write the UTF-8 encoding of a code point, returning its length in bytes.
+inline int utf8_encode(char32_t c, char *out) {
+  if (c < 0x80) {
+    out[0] = char(c);
+    return 1;
+  }
+  int len = c < 0x800? 2 : c < 0x10000? 3 : 4;
+  for (int i = len - 1; i > 0; --i, c >>= 6)
+    out[i] = char(0x80 | (c & 0x3F));
+  out[0] = char((0xF00 >> len) | c); // 0xC0, 0xE0 or 0xF0
+  return len;
+}
+
+/**
+ * A read-only view of UTF-8 bytes owned by someone else, together with a
+ * prebuilt checkpoint index, so that nothing has to be scanned to find a
+ * character. The checkpoints are little-endian 32-bit byte offsets of every
+ * STRIDE'th character; they need not be aligned. This is the layout in which
+ * eff::data_builder stores strings.
+ */
+class utf8_view {
+  const char *bytes;
+  size_t nbytes;
+  const char *checkpoints;
+  size_t nchars;
+  
+  inline size_t checkpoint(size_t i) const {
+    const unsigned char *p = (const unsigned char*) checkpoints + 4 * i;
+    return p[0] | p[1] << 8 | p[2] << 16 | size_t(p[3]) << 24;
+  }
+  
+  inline size_t byte_of_unsafe(size_t n) const {
+    size_t closest = n & ~size_t(STRIDE - 1);
+    size_t bat = checkpoint(n / STRIDE);
+    while (closest < n) {
+      ++closest;
+      while (++bat < nbytes && utf8_is_fragment(bytes[bat]));
+    }
+    return bat;
+  }
+  
+public:
+  enum { STRIDE = 8 };
+  
+  utf8_view(): bytes(""), nbytes(0), checkpoints(NULL), nchars(0) {}
+  utf8_view(const char *b, size_t nb, const char *cps, size_t nc):
+      bytes(b), nbytes(nb), checkpoints(cps), nchars(nc) {}
+  
+  size_t size()        const UTF8S_NOEXCEPT { return nbytes; }
+  size_t length()      const UTF8S_NOEXCEPT { return nchars; }
+  bool empty()         const UTF8S_NOEXCEPT { return !nbytes; }
+  const char *data()   const UTF8S_NOEXCEPT { return bytes; }
+  std::string str()    const { return std::string(bytes, nbytes); }
+  
+  /// Returns the number of checkpoints in the index.
+  size_t checkpoint_count() const UTF8S_NOEXCEPT { return (nchars + STRIDE - 1) / STRIDE; }
+  /// Returns the byte offset of the (i * STRIDE)th character.
+  size_t checkpoint_at(size_t i) const { return checkpoint(i); }
+  
+  size_t byte_of(size_t n) const {
+    if (n > nchars)
+      throw std::range_error("utf8::utf8_view::byte_of(): index out of bounds");
+    return n == nchars? nbytes : byte_of_unsafe(n);
+  }
+  
+  int at(size_t n) const {
+    if (n >= nchars)
+      throw std::range_error("utf8::utf8_view::at(): index out of bounds");
+    size_t b = byte_of_unsafe(n);
+    char c = bytes[b];
+    if (!(c & 0x80))
+      return c;
+    int len = utf8_length_of(c), accum = c & utf8_mask_for(c);
+    for (int i = 1; i < len && b + i < nbytes; ++i)
+      accum = (accum << 6) | (bytes[b + i] & 0x3F);
+    return accum;
+  }
+  inline int operator[](size_t n) const { return at(n); }
+  
+  std::string substdstr(size_t pos, size_t len = std::string::npos) const {
+    if (pos > nchars)
+      throw std::range_error("utf8::utf8_view::substdstr(): index out of bounds");
+    size_t from = byte_of(pos);
+    if (len == std::string::npos || pos + len >= nchars)
+      return std::string(bytes + from, nbytes - from);
+    return std::string(bytes + from, byte_of_unsafe(pos + len) - from);
+  }
+};
+
+/**
+ * A UTF-8 string, indexed so that finding the nth character only scans from
+ * the nearest of every few characters. The allocator is used for the bytes
+ * and the index alike; utf8::pmr::utf8_string draws both from a
+ * std::pmr::memory_resource, such as an arena shared with other strings.
+ */
+template<class Alloc = std::allocator<char> >
+class basic_utf8_string {
+public:
+  typedef Alloc allocator_type;
+  typedef std::basic_string<char, std::char_traits<char>, Alloc> string_type;
+  
+private:
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<size_t> index_allocator;
+  typedef std::basic_string<size_t, std::char_traits<size_t>, index_allocator> index_type;
+  
+  string_type data;
+  index_type nthcharat;
   size_t utf8length;
+  mutable index_type linestarts; ///< Byte offset of each line, once something asks for lines
+  mutable index_type linechars;  ///< Index of each line's first character
+  mutable bool lines_indexed;
   
   enum {
     SHIFTBY     = po2log2<sizeof(size_t)>::v,
@@ -58,19 +190,6 @@ class utf8_string {
     LOSTBITS    = CHARSPERIND - 1
   };
   
-  static inline char maskfor(char c) {
-    return 
-        "\x1F\x1F\x1F\x1F\x1F\x1F\x1F\x1F" "\x1F\x1F\x1F\x1F\x1F\x1F\x1F\x1F"
-        "\x0F\x0F\x0F\x0F\x0F\x0F\x0F\x0F" "\x07\x07\x07\x07\x03\x03\x01"
-        [(c & 0x3E) >> 1]; // 0x3E = 0b00111110
-  }
-  static inline int length_of(char c) {
-    return
-        "\2\2\2\2\2\2\2\2" "\2\2\2\2\2\2\2\2"
-        "\3\3\3\3\3\3\3\3" "\4\4\4\4\5\5\6\1"
-        [(c & 0x3E) >> 1]; // 0x3E = 0b00111110
-  }
-  
   inline size_t byte_of_unsafe(size_t n) const {
     size_t closest = n & ~LOSTBITS;
     size_t bat = nthcharat[n >> SHIFTBY];
@@ -81,13 +200,15 @@ class utf8_string {
     return bat;
   }
   
-  inline void build_index(size_t from = 0) {
+  /// Index the characters from the given one, which starts at the given byte.
+  inline void build_index(size_t from = 0, size_t from_byte = 0) {
+    UTF8S_TIME(STAT_NS_BUILD_INDEX);
+    drop_lines();
     const size_t sz = data.length();
     nthcharat.reserve((sz >> SHIFTBY) + 1);
     utf8length = from;
-    if (from)
-      nthcharat.resize(from >> SHIFTBY);
-    for (size_t i = from? byte_of_unsafe(from) : 0; i < sz; ) {
+    nthcharat.resize((from + LOSTBITS) >> SHIFTBY);
+    for (size_t i = from_byte; i < sz; ) {
       if (!(utf8length & LOSTBITS))
         nthcharat.append(1, i);
       while (++i < sz && utf8_is_fragment(data.at(i)));
@@ -96,7 +217,7 @@ class utf8_string {
   }
   
   inline int utf8char_at_byte(size_t n, char c, int len) const {
-    int accum = c & maskfor(c); // Pull the first bits.
+    int accum = c & utf8_mask_for(c); // Pull the first bits.
     for (int lenof = len; lenof > 1; --lenof) {
       ++n;
       if (n > data.length())
@@ -115,7 +236,7 @@ class utf8_string {
     if (c & 0x80) { // If the high bit isn't set, this is an ASCII char.
       if (!(c & 0x40)) // If the second bit is zero, this is supposed to be
         throw "lrn2utf8"; // part of another character. Throw.
-      return utf8char_at_byte(n, c, length_out = length_of(c));
+      return utf8char_at_byte(n, c, length_out = utf8_length_of(c));
     }
     length_out = 1;
     return c;
@@ -132,7 +253,14 @@ class utf8_string {
     return len;
   }
   
+  inline void drop_lines() {
+    linestarts.clear();
+    linechars.clear();
+    lines_indexed = false;
+  }
+  
   inline void shrink_to(size_t n) {
+    drop_lines();
     size_t bl = byte_of_unsafe(n);
     data.resize(bl);
     nthcharat.resize((n + LOSTBITS) >> SHIFTBY);
@@ -146,10 +274,11 @@ public:
   size_t capacity()        const UTF8S_NOEXCEPT { return data.capacity(); }
   bool empty()             const UTF8S_NOEXCEPT { return data.empty(); }
   const char *c_str()      const UTF8S_NOEXCEPT { return data.c_str(); }
-  const std::string &str() const UTF8S_NOEXCEPT { return data; }
+  const string_type &str() const UTF8S_NOEXCEPT { return data; }
+  allocator_type get_allocator() const { return data.get_allocator(); }
   
-  bool operator==(const utf8_string &x) const { return data == x.data; }
-  bool operator!=(const utf8_string &x) const { return data == x.data; }
+  bool operator==(const basic_utf8_string &x) const { return data == x.data; }
+  bool operator!=(const basic_utf8_string &x) const { return data != x.data; }
   
   void reserve(size_t n = 0) {
     data.reserve(n);
@@ -168,6 +297,7 @@ public:
   }
   void resize(size_t n) {
     if (n > utf8length) {
+      drop_lines();
       size_t szo = data.size();
       data.resize(szo + n - utf8length);
       size_t leno = utf8length;
@@ -183,19 +313,55 @@ public:
     
   }
   
-  utf8_string(const char* x): data(x), nthcharat() {
+  basic_utf8_string(const char* x, const Alloc &a = Alloc()):
+      data(x, a), nthcharat(a), linestarts(a), linechars(a), lines_indexed(false) {
     build_index();
   }
-  utf8_string(const std::string &x): data(x), nthcharat() {
+  basic_utf8_string(const std::string &x, const Alloc &a = Alloc()):
+      data(x.data(), x.size(), a), nthcharat(a), linestarts(a), linechars(a), lines_indexed(false) {
     build_index();
   }
-  utf8_string(): data(), nthcharat(), utf8length(0) {
+  basic_utf8_string(): data(), nthcharat(), utf8length(0), linestarts(), linechars(), lines_indexed(false) {
+  }
+  explicit basic_utf8_string(const Alloc &a): data(a), nthcharat(a), utf8length(0), linestarts(a), linechars(a), lines_indexed(false) {
+  }
+  basic_utf8_string(const basic_utf8_string &x, const Alloc &a):
+      data(x.data, a), nthcharat(x.nthcharat, a), utf8length(x.utf8length), linestarts(a), linechars(a), lines_indexed(false) {}
+  
+  /// Copy the bytes of a view, adopting its checkpoints rather than
+  /// rescanning the string when the strides agree.
+  explicit basic_utf8_string(const utf8_view &v, const Alloc &a = Alloc()):
+      data(v.data(), v.size(), a), nthcharat(a), utf8length(v.length()), linestarts(a), linechars(a), lines_indexed(false) {
+    if (int(utf8_view::STRIDE) != int(CHARSPERIND)) {
+      build_index();
+      return;
+    }
+    nthcharat.resize(v.checkpoint_count());
+    for (size_t i = 0; i < nthcharat.size(); ++i)
+      nthcharat[i] = v.checkpoint_at(i);
   }
   
   size_t byte_of(size_t n) const {
     if (n < 0 || n > utf8length)
       throw "a fit";
-    return byte_of_unsafe(n);
+    return n == utf8length? data.size() : byte_of_unsafe(n);
+  }
+  
+  /// Returns the index of the character starting at, or containing, the
+  /// given byte, by binary search of the checkpoints.
+  size_t char_of_byte(size_t b) const {
+    if (b >= data.size()) {
+      if (b == data.size())
+        return utf8length;
+      throw std::range_error("utf8::string::char_of_byte(): index out of bounds");
+    }
+    const size_t k = std::upper_bound(nthcharat.begin(), nthcharat.end(), b) - nthcharat.begin() - 1;
+    size_t n = k << SHIFTBY;
+    for (size_t next = nthcharat[k]; ; ++n) {
+      while (++next < data.size() && utf8_is_fragment(data[next]));
+      if (next > b)
+        return n;
+    }
   }
   
   int at(size_t n) const {
@@ -208,7 +374,7 @@ public:
     return at(n);
   }
   
-  std::basic_string<size_t> debug() {
+  index_type debug() {
     return nthcharat;
   }
   
@@ -216,29 +382,121 @@ public:
     if (pos > utf8length)
       throw std::range_error("utf8::string::substdstr(): index out of bounds");
     if (len == std::string::npos)
-      return data.substr(byte_of_unsafe(pos));
+      return std::string(data.data() + byte_of_unsafe(pos), data.data() + data.size());
     size_t last = pos + len - 1;
     if (last > utf8length)
       throw std::range_error("utf8::string::substdstr(): length out of bounds");
     size_t from = byte_of_unsafe(pos), to = byte_of_unsafe(last);
-    return data.substr(from, to + length_at_byte(to) - from);
+    return std::string(data.data() + from, to + length_at_byte(to) - from);
   }
   
-  utf8_string &operator+=(const utf8_string& app) {
-    data.operator+=((std::string)app);
-    if ((utf8length & LOSTBITS) == LOSTBITS) {
-      nthcharat += app.nthcharat;
-      return *this;
+  static constexpr size_t npos = size_t(-1);
+  
+  /// Returns the index of the first occurrence of the given text starting
+  /// at or after the given character, or npos. The bytes are searched with
+  /// memchr, and only a match is converted back to a character index.
+  /// To look for another utf8_string, pass its str().
+  size_t find(std::string_view s, size_t pos = 0) const {
+    if (pos > utf8length)
+      return npos;
+    const size_t b = std::string_view(data).find(s, byte_of(pos));
+    return b == std::string_view::npos? npos : char_of_byte(b);
+  }
+  size_t find(char32_t c, size_t pos = 0) const {
+    char enc[4];
+    return find(std::string_view(enc, utf8_encode(c, enc)), pos);
+  }
+  
+  /// Returns the index of the last occurrence of the given text starting
+  /// at or before the given character, or npos.
+  size_t rfind(std::string_view s, size_t pos = npos) const {
+    const size_t b = std::string_view(data).rfind(s, pos >= utf8length? data.size() : byte_of_unsafe(pos));
+    return b == std::string_view::npos? npos : char_of_byte(b);
+  }
+  size_t rfind(char32_t c, size_t pos = npos) const {
+    char enc[4];
+    return rfind(std::string_view(enc, utf8_encode(c, enc)), pos);
+  }
+  
+  /// A position as an editor shows it; both count from zero, and columns
+  /// count characters rather than bytes.
+  struct line_col {
+    size_t line, column;
+  };
+  
+  /// Find where each line starts, so that line_col_of() and offset_of()
+  /// are binary searches. They call this themselves the first time; call
+  /// it first if several threads will ask of the same string at once.
+  /// Lines end after each '\n'. Modifying the string discards this index.
+  void index_lines() const {
+    if (lines_indexed)
+      return;
+    const char *const begin = data.data(), *const end = begin + data.size();
+    linestarts.assign(1, 0);
+    linechars.assign(1, 0);
+    for (const char *nl = begin; (nl = (const char*) memchr(nl, '\n', end - nl)); ) {
+      linestarts.append(1, ++nl - begin);
+      linechars.append(1, char_of_byte(nl - begin));
     }
-    build_index(utf8length);
+    lines_indexed = true;
+  }
+  
+  size_t line_count() const {
+    index_lines();
+    return linestarts.size();
+  }
+  
+  /// Returns the line and column of the character at the given byte.
+  line_col line_col_of_byte(size_t b) const {
+    if (b > data.size())
+      throw std::range_error("utf8::string::line_col_of_byte(): index out of bounds");
+    index_lines();
+    const size_t line = std::upper_bound(linestarts.begin(), linestarts.end(), b) - linestarts.begin() - 1;
+    line_col res = { line, char_of_byte(b) - linechars[line] };
+    return res;
+  }
+  /// Returns the line and column of the given character.
+  line_col line_col_of(size_t n) const {
+    if (n > utf8length)
+      throw std::range_error("utf8::string::line_col_of(): index out of bounds");
+    index_lines();
+    const size_t line = std::upper_bound(linechars.begin(), linechars.end(), n) - linechars.begin() - 1;
+    line_col res = { line, n - linechars[line] };
+    return res;
+  }
+  
+  /// Returns the index of the character at the given line and column. The
+  /// column may be the length of the line, giving its newline or the end.
+  size_t offset_of(size_t line, size_t column) const {
+    index_lines();
+    if (line >= linestarts.size())
+      throw std::range_error("utf8::string::offset_of(): line out of bounds");
+    const size_t first = linechars[line];
+    const size_t last = line + 1 < linechars.size()? linechars[line + 1] - 1 : utf8length;
+    if (column > last - first)
+      throw std::range_error("utf8::string::offset_of(): column out of bounds");
+    return first + column;
+  }
+  
+  basic_utf8_string &operator+=(const basic_utf8_string& app) {
+    const size_t end = data.size();
+    data.operator+=(app.data);
+    build_index(utf8length, end);
     return *this;
   }
   
-  operator const std::string&() const { return data; }
-  operator std::string() { return data; }
+  operator const string_type&() const { return data; }
+  operator std::string() { return std::string(data.data(), data.size()); }
 };
 
-static inline std::ostream &operator<<(std::ostream &os, const utf8_string &s) { 
+typedef basic_utf8_string<> utf8_string;
+
+namespace pmr {
+  typedef basic_utf8_string<std::pmr::polymorphic_allocator<char> > utf8_string;
+}
+
+template<class Alloc>
+static inline std::ostream &operator<<(std::ostream &os, const basic_utf8_string<Alloc> &s) { 
     return os << s.str();
 }
 
@@ -0,0 +1,111 @@
+/**
+ * @file  zip_writer.hpp
+ * @brief Zip archive creation.
+ *
+ * Declares a writer that packs files from disk or memory into a zip archive,
+ * compressing entries independently on a pool of threads before appending
+ * them in order, followed by the central directory.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#ifndef e_ZIP_WRITER_H
+#define e_ZIP_WRITER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <iosfwd>
+#include <stdint.h>
+
+namespace eff {
+  using std::string;
+
+  class zip_writer {
+    public:
+    enum method {
+      AUTO    = -1, ///< Let the policy decide
+      STORED  =  0,
+      DEFLATE =  8
+    };
+
+    /// Decides how entries added with AUTO are compressed.
+    struct policy {
+      /// Extensions (lowercase, with the dot) of formats that are already
+      /// compressed, such as ".png" or ".ogg"; these are always stored.
+      std::set<string> stored_extensions;
+      /// Entries smaller than this many bytes are stored.
+      size_t store_below;
+      /// The zlib compression level for deflated entries, 0-9.
+      int level;
+      policy();
+    };
+
+    /// Prepare to write the archive at the given path. Nothing is written
+    /// until close(). A thread count of zero uses one per hardware thread.
+    explicit zip_writer(string zipfile, unsigned threads = 0);
+    /// Discards the entries if close() was never called.
+    ~zip_writer();
+
+    void set_policy(const policy &p) { pol = p; }
+    const policy &get_policy() const { return pol; }
+
+    /// Add a file from disk under the given name in the archive.
+    void add_file(string name, string path, method m = AUTO);
+    /// Add an entry with the given contents.
+    void add_memory(string name, string data, method m = AUTO);
+    /// Add an empty directory entry; directories containing files need not
+    /// be added.
+    void add_directory(string name);
+    /// Add every file and directory under a directory on disk, naming them
+    /// relative to it, under the given prefix.
+    bool add_tree(string path, string prefix = "");
+
+    size_t entry_count() const { return entries.size(); }
+
+    /// Compress and write everything added so far, then close the archive.
+    /// Files are streamed from disk, and only deflated contents are held in
+    /// memory, for a bounded window of entries.
+    /// @return Returns true if the archive was written successfully; if not,
+    ///         the partly written archive is removed.
+    bool close();
+
+    private:
+    struct entry {
+      string name;
+      string path;     ///< Where to read the contents from, if not from memory
+      string data;     ///< The contents, if added from memory
+      int method;
+      uint16_t dos_time, dos_date;
+      bool is_dir;
+    };
+
+    string zipfile;
+    unsigned threads;
+    policy pol;
+    std::vector<entry> entries;
+    bool closed;
+
+    int choose_method(const entry &e, uint64_t size) const;
+    bool write_archive(std::ostream &out) const;
+    friend struct zip_pack_job;
+
+    zip_writer(const zip_writer&);
+    zip_writer &operator=(const zip_writer&);
+  };
+}
+
+#endif
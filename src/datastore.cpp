@@ -0,0 +1,357 @@
+/**
+ * @file  datastore.cpp
+ * @brief Binary data storage for object serialization.
+ *
+ * Implements the builder and the reader declared in datastore.hpp, and the
+ * platform-specific mapping of data files.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "datastore.hpp"
+#include "eff_stats.hpp"
+#include <algorithm>
+
+#if !defined(EFF_WINDOWS) && !defined(EFF_POSIX)
+#  if defined(_WIN32) || defined(__WIN32__) || defined(_WIN64) || defined(__WIN64__)
+#    define EFF_WINDOWS
+#  else
+#    define EFF_POSIX
+#  endif
+#endif
+
+#ifdef EFF_POSIX
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+namespace eff {
+  using data_detail::load;
+  using data_detail::store;
+
+  static inline void bounds_check(uint64_t end, size_t len, const char *who) {
+    if (end > len)
+      throw std::range_error(who);
+  }
+
+  /* ******************************************************************************************* *\
+  |* Reading ************************************************************************************ *|
+  \* ******************************************************************************************* */
+
+  static data_string string_at(const char *base, size_t len, uint32_t at) {
+    if (!at) return data_string();
+    bounds_check(at + 8ull, len, "eff::data_string: header out of bounds");
+    uint32_t bytes = load<uint32_t>(base + at), chars = load<uint32_t>(base + at + 4);
+    uint64_t index = (at + 8ull + bytes + 1 + 3) & ~3ull;
+    bounds_check(index + 4ull * ((chars + 7) / 8), len, "eff::data_string: string out of bounds");
+    return data_string(base + at + 8, bytes, chars, base + index);
+  }
+
+  data_table::data_table(const char *b, size_t l, uint32_t p): base(b), len(l), pos(p), vtable(0), vtable_size(0) {
+    if (!p) {
+      base = NULL;
+      return;
+    }
+    bounds_check(p + 4ull, len, "eff::data_table: table out of bounds");
+    vtable = load<uint32_t>(base + p);
+    bounds_check(vtable + 4ull, len, "eff::data_table: vtable out of bounds");
+    vtable_size = load<uint16_t>(base + vtable);
+    if (vtable_size < 4 || vtable_size % 2)
+      throw std::range_error("eff::data_table: malformed vtable");
+    bounds_check(vtable + (uint64_t) vtable_size, len, "eff::data_table: vtable out of bounds");
+  }
+
+  uint32_t data_table::field_pos(uint16_t id) const {
+    if (!base || 4u + 2u * id + 2u > vtable_size)
+      return 0;
+    uint16_t off = load<uint16_t>(base + vtable + 4 + 2 * id);
+    return off? pos + off : 0;
+  }
+
+  uint32_t data_table::field_ref(uint16_t id) const {
+    uint32_t at = field_pos(id);
+    if (!at) return 0;
+    bounds_check(at + 4ull, len, "eff::data_table: field out of bounds");
+    uint32_t res = load<uint32_t>(base + at);
+    bounds_check(res + 4ull, len, "eff::data_table: reference out of bounds");
+    return res;
+  }
+
+  data_string data_table::get_string(uint16_t id) const {
+    return string_at(base, len, field_ref(id));
+  }
+
+  data_table data_table::get_table(uint16_t id) const {
+    return data_table(base, len, field_ref(id));
+  }
+
+  data_ref_vector data_table::get_refs(uint16_t id) const {
+    uint32_t at = field_ref(id);
+    if (!at) return data_ref_vector();
+    uint32_t count = load<uint32_t>(base + at);
+    bounds_check(at + 4ull + 4ull * count, len, "eff::data_table::get_refs(): vector out of bounds");
+    return data_ref_vector(base, len, at + 4, count);
+  }
+
+  uint32_t data_ref_vector::ref(size_t i) const {
+    if (i >= count)
+      throw std::range_error("eff::data_ref_vector: index out of bounds");
+    return load<uint32_t>(base + pos + 4 * i);
+  }
+
+  data_table data_ref_vector::get_table(size_t i) const {
+    return data_table(base, len, ref(i));
+  }
+
+  data_string data_ref_vector::get_string(size_t i) const {
+    return string_at(base, len, ref(i));
+  }
+
+  data_reader::data_reader(const void *data, size_t size): base((const char*) data), len(size) {
+    if (!base || len < data_detail::HEADER_SIZE || memcmp(base, "EFFD", 4)
+        || load<uint16_t>(base + 4) != data_detail::FORMAT_VERSION
+        || load<uint32_t>(base + 12) > len)
+      base = NULL, len = 0;
+    else
+      len = load<uint32_t>(base + 12);
+  }
+
+  uint16_t data_reader::schema_version() const {
+    return base? load<uint16_t>(base + 6) : 0;
+  }
+
+  data_table data_reader::root() const {
+    if (!base) return data_table();
+    return data_table(base, len, load<uint32_t>(base + 8));
+  }
+
+  /* ******************************************************************************************* *\
+  |* Writing ************************************************************************************ *|
+  \* ******************************************************************************************* */
+
+  data_builder::data_builder(uint16_t schema_version): buf(), fields(), vtables(), in_table(false) {
+    char header[data_detail::HEADER_SIZE] = { 'E', 'F', 'F', 'D' };
+    store<uint16_t>(header + 4, data_detail::FORMAT_VERSION);
+    store<uint16_t>(header + 6, schema_version);
+    buf.assign(header, sizeof header);
+  }
+
+  void data_builder::align(size_t n) {
+    buf.append((n - buf.size() % n) % n, '\0');
+  }
+
+  void data_builder::not_in_table(const char *who) const {
+    if (in_table)
+      throw std::logic_error(string("eff::data_builder::") + who + "(): a table is open");
+  }
+
+  data_builder::ref data_builder::add_string(const string &str) {
+    not_in_table("add_string");
+    align(4);
+    ref res = buf.size();
+    utf8::utf8_string u = str;
+    char b[4];
+    store<uint32_t>(b, str.size());
+    buf.append(b, 4);
+    store<uint32_t>(b, u.length());
+    buf.append(b, 4);
+    buf.append(str.c_str(), str.size() + 1);
+    align(4);
+    for (size_t i = 0; i < u.length(); i += utf8::utf8_view::STRIDE) {
+      store<uint32_t>(b, u.byte_of(i));
+      buf.append(b, 4);
+    }
+    return res;
+  }
+
+  data_builder::ref data_builder::add_refs(const std::vector<ref> &refs) {
+    not_in_table("add_refs");
+    align(4);
+    ref res = buf.size();
+    char b[4];
+    store<uint32_t>(b, refs.size());
+    buf.append(b, 4);
+    for (size_t i = 0; i < refs.size(); ++i) {
+      store<uint32_t>(b, refs[i]);
+      buf.append(b, 4);
+    }
+    return res;
+  }
+
+  void data_builder::start_table() {
+    not_in_table("start_table");
+    in_table = true;
+    fields.clear();
+  }
+
+  void data_builder::add_field(uint16_t id, const void *v, uint16_t size) {
+    if (!in_table)
+      throw std::logic_error("eff::data_builder::field(): no table is open");
+    pending_field f;
+    f.id = id;
+    f.size = size;
+    if (data_detail::host_is_little())
+      memcpy(f.bytes, v, size);
+    else for (size_t i = 0; i < size; ++i)
+      f.bytes[i] = ((const char*) v)[size - 1 - i];
+    for (size_t i = 0; i < fields.size(); ++i)
+      if (fields[i].id == id) {
+        fields[i] = f;
+        return;
+      }
+    fields.push_back(f);
+  }
+
+  static bool larger_field_first(const data_builder::ref &a, const data_builder::ref &b) {
+    return (a >> 16) > (b >> 16);
+  }
+
+  data_builder::ref data_builder::end_table() {
+    if (!in_table)
+      throw std::logic_error("eff::data_builder::end_table(): no table is open");
+    in_table = false;
+
+    // Lay fields out largest first, so that each is naturally aligned
+    // without padding once the table itself is aligned to eight bytes.
+    std::vector<ref> order(fields.size());
+    uint16_t max_id = 0;
+    for (size_t i = 0; i < fields.size(); ++i) {
+      order[i] = fields[i].size << 16 | i;
+      max_id = std::max<uint16_t>(max_id, fields[i].id + 1);
+    }
+    std::stable_sort(order.begin(), order.end(), larger_field_first);
+
+    string vt(4 + 2 * max_id, '\0');
+    uint16_t table_size = 4;
+    for (size_t i = 0; i < order.size(); ++i) {
+      const pending_field &f = fields[order[i] & 0xFFFF];
+      table_size = (table_size + f.size - 1) / f.size * f.size;
+      store<uint16_t>(&vt[4 + 2 * f.id], table_size);
+      table_size += f.size;
+    }
+    store<uint16_t>(&vt[0], vt.size());
+    store<uint16_t>(&vt[2], table_size);
+
+    uint32_t vt_at;
+    std::map<string, uint32_t>::iterator known = vtables.find(vt);
+    if (known != vtables.end())
+      vt_at = known->second;
+    else {
+      align(4);
+      vt_at = buf.size();
+      buf += vt;
+      vtables[vt] = vt_at;
+    }
+
+    align(8);
+    ref res = buf.size();
+    buf.append(table_size, '\0');
+    store<uint32_t>(&buf[res], vt_at);
+    for (size_t i = 0; i < fields.size(); ++i)
+      memcpy(&buf[res + load<uint16_t>(&vt[4 + 2 * fields[i].id])], fields[i].bytes, fields[i].size);
+    fields.clear();
+    return res;
+  }
+
+  const string &data_builder::finish(ref root) {
+    not_in_table("finish");
+    align(8);
+    store<uint32_t>(&buf[8], root);
+    store<uint32_t>(&buf[12], buf.size());
+    return buf;
+  }
+
+  /* ******************************************************************************************* *\
+  |* Mapping files ****************************************************************************** *|
+  \* ******************************************************************************************* */
+
+  /// Find a STORED entry by reading the zip's central directory in place.
+  static bool find_stored_entry(const char *zip, size_t size, const string &entry, const char *&start, size_t &len) {
+    if (size < 22) return false;
+    size_t eocd = size - 22;
+    while (load<uint32_t>(zip + eocd) != 0x06054b50)
+      if (!eocd-- || size - eocd > 22 + 0xFFFF)
+        return false;
+    uint16_t count = load<uint16_t>(zip + eocd + 10);
+    uint64_t at = load<uint32_t>(zip + eocd + 16);
+    for (uint16_t i = 0; i < count; ++i) {
+      if (at + 46 > size || load<uint32_t>(zip + at) != 0x02014b50)
+        return false;
+      uint16_t nlen = load<uint16_t>(zip + at + 28);
+      uint64_t next = at + 46 + nlen + load<uint16_t>(zip + at + 30) + load<uint16_t>(zip + at + 32);
+      if (next > size) return false;
+      if (nlen == entry.size() && !memcmp(zip + at + 46, entry.data(), nlen)) {
+        if (load<uint16_t>(zip + at + 10) != 0) // Compressed; can't be read in place
+          return false;
+        uint64_t local = load<uint32_t>(zip + at + 42);
+        if (local + 30 > size) return false;
+        uint64_t data = local + 30 + load<uint16_t>(zip + local + 26) + load<uint16_t>(zip + local + 28);
+        len = load<uint32_t>(zip + at + 20);
+        if (data + len > size) return false;
+        start = zip + data;
+        return true;
+      }
+      at = next;
+    }
+    return false;
+  }
+
+# ifdef EFF_WINDOWS
+    // TODO: write, using CreateFileMapping/MapViewOfFile
+    bool data_file::map_file(const string &) { return false; }
+    data_file::~data_file() {}
+# else
+    bool data_file::map_file(const string &path) {
+      EFF_COUNT(STAT_SYSCALLS, 1);
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) return false;
+      struct stat sb;
+      EFF_COUNT(STAT_SYSCALLS, 2); // fstat, then close now or after mapping
+      if (fstat(fd, &sb) || !sb.st_size) {
+        ::close(fd);
+        return false;
+      }
+      EFF_COUNT(STAT_SYSCALLS, 1);
+      void *m = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (m == MAP_FAILED) return false;
+      map = m;
+      map_size = sb.st_size;
+      return true;
+    }
+    data_file::~data_file() {
+      if (map) {
+        EFF_COUNT(STAT_SYSCALLS, 1);
+        munmap(map, map_size);
+      }
+    }
+# endif
+
+  data_file::data_file(const string &path): map(NULL), map_size(0), start(NULL), size(0) {
+    if (map_file(path)) {
+      start = (const char*) map;
+      size = map_size;
+    }
+  }
+
+  data_file::data_file(const string &zipfile, const string &entry): map(NULL), map_size(0), start(NULL), size(0) {
+    if (map_file(zipfile) && !find_stored_entry((const char*) map, map_size, entry, start, size))
+      start = NULL, size = 0;
+  }
+}
@@ -0,0 +1,136 @@
+/**
+ * @file  eff_stats.cpp
+ * @brief Opt-in instrumentation counters.
+ *
+ * Implements the per-thread counter blocks and their aggregation, and, in
+ * instrumented builds, the operator new that counts heap allocations.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "eff_stats.hpp"
+#include <mutex>
+#include <new>
+#include <cstdlib>
+
+namespace eff {
+  const char *stats::name(stat_id id) {
+    switch (id) {
+      case STAT_SYSCALLS:           return "syscalls";
+      case STAT_ENTRIES_LISTED:     return "entries_listed";
+      case STAT_BYTES_DECOMPRESSED: return "bytes_decompressed";
+      case STAT_CACHE_HITS:         return "cache_hits";
+      case STAT_CACHE_MISSES:       return "cache_misses";
+      case STAT_ALLOCATIONS:        return "allocations";
+      case STAT_NS_LIST_DIRECTORY:  return "ns_list_directory";
+      case STAT_NS_OPEN_ZIP:        return "ns_open_zip";
+      case STAT_NS_BUILD_INDEX:     return "ns_build_index";
+      case STAT_COUNT:
+      default: return "";
+    }
+  }
+
+  namespace stats_detail {
+    /* ***************************************************************************************** *\
+    |* Every live thread's block is linked into one list, so totals can be gathered on demand. * *|
+    |* Nothing here may allocate: these blocks are created from inside operator new. *********** *|
+    \* ***************************************************************************************** */
+
+    struct registered_block;
+    struct block_registry {
+      std::mutex mtx;
+      registered_block *live;
+      stats retired;  ///< Totals of threads that have exited
+      counter_block orphans; ///< Counted by threads after their block was destroyed
+      block_registry(): mtx(), live(NULL), retired(), orphans() {}
+    };
+    static block_registry &registry() {
+      static block_registry reg;
+      return reg;
+    }
+
+    static thread_local bool block_destroyed = false;
+
+    struct registered_block: counter_block {
+      registered_block *prev, *next;
+      registered_block(): prev(NULL), next(NULL) {
+        block_registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mtx);
+        if ((next = reg.live))
+          next->prev = this;
+        reg.live = this;
+      }
+      ~registered_block() {
+        block_registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mtx);
+        reg.retired += snapshot();
+        (prev? prev->next : reg.live) = next;
+        if (next)
+          next->prev = prev;
+        block_destroyed = true;
+      }
+    };
+
+    counter_block *thread_block() {
+      if (block_destroyed)
+        return NULL;
+      static thread_local registered_block block;
+      return &block;
+    }
+
+    counter_block &orphan_block() {
+      return registry().orphans;
+    }
+
+    handle_scope *&charged_scope() {
+      static thread_local handle_scope *current = NULL;
+      return current;
+    }
+  }
+
+  stats global_statistics() {
+    stats_detail::block_registry &reg = stats_detail::registry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+    stats res = reg.retired;
+    res += reg.orphans.snapshot();
+    for (stats_detail::registered_block *b = reg.live; b; b = b->next)
+      res += b->snapshot();
+    return res;
+  }
+}
+
+#ifdef EFF_INSTRUMENT
+
+void *operator new(size_t size) {
+  eff::stats_detail::count(eff::STAT_ALLOCATIONS, 1);
+  for (;;) {
+    if (void *p = std::malloc(size? size : 1))
+      return p;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+void *operator new(size_t size, const std::nothrow_t&) noexcept {
+  try { return operator new(size); }
+  catch (const std::bad_alloc&) { return NULL; }
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); } // Called directly since C++14
+
+#endif
@@ -22,14 +22,29 @@
 **/
  
 #include "gdir.hpp"
+#include "utf8_fold.hpp"
 #include <zip.h>
 #include <vector>
 #include <deque>
 #include <map>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
 
 using std::deque;
 using std::vector;
 using std::map;
+using eff::listing_detail::folded_names;
+using eff::listing_detail::entry_array;
+using eff::listing_detail::lazy_slot;
 
 // Determine whether we're on a Windows or POSIX machine.
 // It is assumed that everything that isn't Windows is POSIX-compliant or else not going to run this.
@@ -47,27 +62,83 @@ using std::map;
 #  include <sys/types.h>
 #  include <sys/stat.h>
 #  include <dirent.h>
+#  include <fcntl.h>
 #  include <unistd.h>
 #endif // EFF_WINDOWS
 
 namespace eff {
   
+  void folded_names::add(table &t, std::string_view name) {
+    t.insert(table::value_type(utf8::fold_key(name.data(), name.size()), name));
+  }
+  std::string_view folded_names::find(const table &t, const string &name) {
+    table::const_iterator it = t.find(utf8::fold_key(name));
+    return it == t.end()? std::string_view(name) : it->second;
+  }
+  
+  /* ******************************************************************************************* *\
+  |* Memory for mounted trees: the global heap, or a resource the caller gave us. ************** *|
+  \* ******************************************************************************************* */
+  
+  typedef std::pmr::string pstring;
+  
+  /// Orders names of either string type, so lookups needn't copy them.
+  struct name_less {
+    typedef void is_transparent;
+    bool operator()(std::string_view a, std::string_view b) const { return a < b; }
+  };
+  
+  /// Serializes a caller's resource for one mount, whose listings may be
+  /// made and dropped by several threads at once.
+  class mount_memory: public std::pmr::memory_resource {
+    std::pmr::memory_resource *upstream;
+    std::mutex mtx;
+    
+    void *do_allocate(size_t bytes, size_t alignment) {
+      std::lock_guard<std::mutex> lock(mtx);
+      return upstream->allocate(bytes, alignment);
+    }
+    void do_deallocate(void *p, size_t bytes, size_t alignment) {
+      std::lock_guard<std::mutex> lock(mtx);
+      upstream->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+      return this == &other;
+    }
+    
+    public:
+    mount_memory(std::pmr::memory_resource *up): upstream(up), mtx() {}
+  };
+  
+  /// Held by everything allocated from a mount's memory, so it lasts as
+  /// long as they do. Without a resource, this just points at the heap.
+  typedef std::shared_ptr<std::pmr::memory_resource> memory_ptr;
+  
+  static memory_ptr mount_memory_for(std::pmr::memory_resource *memory) {
+    if (!memory)
+      return memory_ptr(memory_ptr(), std::pmr::new_delete_resource());
+    return std::make_shared<mount_memory>(memory);
+  }
+  
   /* ******************************************************************************************* *\
   |* Internal structure to represent a hierarchy when there isn't one, or there's no API for it. *|
   \* ******************************************************************************************* */
   
   struct parsed_directory {
-    typedef map<string, parsed_directory> dirmap;
-    typedef map<string, size_t> filemap;
+    typedef std::pmr::map<pstring, parsed_directory, name_less> dirmap;
+    typedef std::pmr::map<pstring, size_t, name_less> filemap;
     typedef dirmap::iterator dirit;
     typedef filemap::iterator fileit;
+    typedef std::pmr::polymorphic_allocator<char> allocator_type; ///< Passed on to subdirectories by dirmap
     
     parsed_directory *parent;
     dirmap subdirs;
     filemap files;
+    lazy_slot<folded_names> folded;
+    lazy_slot<entry_array> views;
     
-    parsed_directory(parsed_directory *p = NULL): parent(p), subdirs(), files() {}
-    parsed_directory(const parsed_directory &d): parent(NULL), subdirs(d.subdirs), files(d.files) {
+    parsed_directory(const allocator_type &a, parsed_directory *p = NULL): parent(p), subdirs(a), files(a), folded(), views() {}
+    parsed_directory(const parsed_directory &d, const allocator_type &a): parent(NULL), subdirs(d.subdirs, a), files(d.files, a), folded(), views() {
       if (d.parent != NULL)
         throw "new shitHappensException()";
     }
@@ -80,24 +151,113 @@ namespace eff {
       for (s = path; *s && *s != '/'; ++s);
       if (*s == '/') {
         if (s == path) return add_file(s + 1, index, parent);
-        return subdirs[string(path, s)].add_file(s + 1, index, this);
+        return subdirs[pstring(path, s, subdirs.get_allocator())].add_file(s + 1, index, this);
       }
       if (s > path)
-      files[string(path, s)] = index;
+      files[pstring(path, s, files.get_allocator())] = index;
     }
   };
   
   /* ******************************************************************************************* *\
-  |* Filesystem directory traversal. Platform-specific, but otherwise self-contained. ********** *|
+  |* The host's file system. The only platform-specific part of directory traversal. ********** *|
+  \* ******************************************************************************************* */
+  
+  struct native_backend: fs_backend {
+#   ifdef EFF_WINDOWS
+      bool list(const string &path, listing_sink &sink) const {
+        // TODO: write
+        // WIN32_FIND_DATA ffound;
+        // HANDLE dir = FindFirstFile(path + "\\*", &ffound)
+        // if (dir == INVALID_HANDLE_VALUE)
+        //   return false;
+        // do {
+        //   const bool is_dir = ffound.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+        //   if (!is_dir || (strcmp(ffound.cFileName, ".") and strcmp(ffound.cFileName, "..")))
+        //     sink.add(ffound.cFileName, is_dir);
+        // } while (FindNextFile(dir, &ffound));
+        // FindClose(dir);
+        // return true;
+        return false;
+      }
+      bool stat(const string &path, entry_info &info) const {
+        return false; // TODO: write, using GetFileAttributesEx
+      }
+      bool read(const string &path, content_sink &sink) const {
+        return false; // TODO: write, using CreateFile/ReadFile
+      }
+#   else
+      static inline bool is_directory(::dirent *file) {
+#       ifdef _DIRENT_HAVE_D_TYPE // Not standard POSIX; ask GLIBC if this system supports file->d_type
+          return file->d_type == DT_DIR;
+#       else // In the event that it does not, we have to call stat...
+          struct stat sb;
+          EFF_COUNT(STAT_SYSCALLS, 1);
+          ::stat(file->d_name, &sb);
+          return sb.st_mode & S_IFDIR;
+#       endif
+      }
+      
+      bool list(const string &path, listing_sink &sink) const {
+        EFF_COUNT(STAT_SYSCALLS, 2); // opendir, and closedir or the failure
+        DIR* dir = ::opendir(path.c_str());
+        if (!dir)
+          return false;
+        for (::dirent* rd; EFF_COUNT(STAT_SYSCALLS, 1), (rd = readdir(dir)); ) {
+          if (!is_directory(rd))
+            sink.add(rd->d_name, false);
+          else if (strcmp(rd->d_name, ".") and strcmp(rd->d_name, ".."))
+            sink.add(rd->d_name, true);
+        }
+        closedir(dir);
+        return true;
+      }
+      
+      bool stat(const string &path, entry_info &info) const {
+        struct stat sb;
+        EFF_COUNT(STAT_SYSCALLS, 1);
+        if (::stat(path.c_str(), &sb))
+          return false;
+        info = entry_info();
+        info.size = info.compressed_size = sb.st_size;
+        info.mtime = sb.st_mtime;
+        info.valid = entry_info::HAS_SIZE | entry_info::HAS_COMPRESSED_SIZE | entry_info::HAS_MTIME | entry_info::HAS_METHOD;
+        return true;
+      }
+      
+      bool read(const string &path, content_sink &sink) const {
+        EFF_COUNT(STAT_SYSCALLS, 2); // open, close
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+          return false;
+        char buf[64 << 10];
+        ssize_t got;
+        bool ok = true;
+        while (ok && (EFF_COUNT(STAT_SYSCALLS, 1), got = ::read(fd, buf, sizeof buf)) > 0)
+          ok = sink.consume(buf, got);
+        ::close(fd);
+        return ok && !got;
+      }
+#   endif
+  };
+  
+  const fs_backend &fs_backend::native() {
+    static const native_backend backend;
+    return backend;
+  }
+  
+  /* ******************************************************************************************* *\
+  |* Filesystem directory traversal, through an fs_backend. *********************************** *|
   \* ******************************************************************************************* */
   
   struct directory_filesystem: public eff::directory {
     struct kernel_filesystem: directory_kernel {
-      typedef deque<string> filelist;
+      typedef std::pmr::deque<pstring> filelist;
       
-      class whole_directory {
+      /// One directory's listing. Never modified once read; refresh()
+      /// reads a new one instead.
+      class whole_directory: listing_sink {
         whole_directory* parent;
-        size_t refs;
+        std::atomic<size_t> refs;
         
         inline void unref_parent() {
           if (parent)
@@ -111,11 +271,17 @@ namespace eff {
         
         public:
         string path;
+        const fs_backend *backend; ///< Where this and its subdirectories are read from
+        memory_ptr memory;         ///< What the names below are allocated from
         
         filelist files;
         filelist dirs;
+        lazy_slot<folded_names> folded;
+        lazy_slot<entry_array> views;
         
-        whole_directory(const whole_directory& d): parent(d.parent), refs(0), path(d.path), files(d.files), dirs(d.dirs) {
+        whole_directory(const whole_directory& d):
+            parent(d.parent), refs(0), path(d.path), backend(d.backend), memory(d.memory),
+            files(d.files, memory.get()), dirs(d.dirs, memory.get()), folded(), views() {
           if (d.parent)
             ref(d.parent);
         }
@@ -124,6 +290,8 @@ namespace eff {
           path = d.path;
           files = d.files;
           dirs = d.dirs;
+          folded = d.folded;
+          views = d.views;
           return *this;
         }
         
@@ -137,93 +305,199 @@ namespace eff {
         }
         
         static void ref(whole_directory* refr) {
-          ++refr->refs;
+          refr->refs.fetch_add(1, std::memory_order_relaxed);
         }
         static void unref(whole_directory* refr) {
-          if (!--refr->refs)
+          if (refr->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
             delete refr;
         }
         
         
 #       ifdef EFF_WINDOWS
 #         define PATH_CHAR "\\"
-          
-          static inline bool is_directory(WIN32_FIND_DATA &ffound) {
-            // TODO: write
-            // return ffound.﻿﻿dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
-            return false;
-          }
-          
-          static inline whole_directory* cache(whole_directory* parent, string dirname) {
-            // TODO: write
-            // WIN32_FIND_DATA ffound;
-            // HANDLE dir = FindFirstFile(dirname + "\\*", &ffound)
-            // if (dir == INVALID_HANDLE_VALUE) {
-            //   DWORD dwAttrib = GetFileAttributes(szPath);
-            //   return (dwAttrib != INVALID_FILE_ATTRIBUTES && (dwAttrib & FILE_ATTRIBUTE_DIRECTORY))?
-            //       new whole_directory(parent, dirname, INVALID_HANDLE_VALUE, ffound);
-            //   return NULL;
-            // }
-            // return new whole_directory(parent, dirname, dir, ffound);
+#       else
+#         define PATH_CHAR "/"
+#       endif
+        
+        static inline whole_directory* cache(whole_directory* parent, string dirname, const fs_backend *backend, const memory_ptr &memory) {
+          EFF_TIME(STAT_NS_LIST_DIRECTORY);
+          EFF_COUNT(STAT_CACHE_MISSES, 1);
+          whole_directory *res = new whole_directory(parent, dirname, backend, memory);
+          if (!backend->list(dirname, *res)) {
+            delete res;
             return NULL;
           }
-          
+          EFF_COUNT(STAT_ENTRIES_LISTED, res->files.size() + res->dirs.size());
+          std::sort(res->files.begin(), res->files.end());
+          std::sort(res->dirs.begin(), res->dirs.end());
+          return res;
+        }
+        
         private:
-          whole_directory(whole_directory *prnt, string dirname, HANDLE dir, WIN32_FIND_DATA &ffound): parent(prnt), refs(0), path(dirname), files(), dirs() {
-            if (parent)
-              ref(parent);
-            // TODO: Iterate all files and directories, caching them.
-            // if (dir == INVALID_HANDLE_VALUE)
-            //   return;
-            // do {
-            //   if (is_directory(rd)) {
-            //     string name = ffound.cFileName;
-            //     if (name != "." and name != "..")
-            //       dirs.push_back(name);
-            //   }
-            //   else files.push_back(ffound.cFileName);
-            // } while (FindNextFile(dir, &ffound));
+        whole_directory(whole_directory *prnt, string dirname, const fs_backend *be, const memory_ptr &mem):
+            parent(prnt), refs(0), path(dirname), backend(be), memory(mem),
+            files(memory.get()), dirs(memory.get()), folded(), views() {
+          if (parent)
+            ref(parent);
+        }
+        
+        void add(const char *name, bool directory) {
+          (directory? dirs : files).emplace_back(name);
+        }
+      };
+      
+      /// Lists subdirectories ahead of a walk on a pool of threads. Shared
+      /// by every kernel entered from the same dirent(); a listing it holds
+      /// is handed to the first kernel to enter that directory.
+      class prefetcher {
+        enum state { QUEUED, LISTING, DONE };
+        struct slot {
+          state st;
+          unsigned depth;           ///< Levels still to prefetch below this one
+          whole_directory *parent;  ///< Referenced until listed
+          whole_directory *listing; ///< Referenced once DONE; NULL if it couldn't be read
+        };
+        enum { MAX_UNCLAIMED = 1024 }; ///< Finished listings kept before the oldest are dropped
+        
+        const prefetch_options opt;
+        std::mutex mtx;
+        std::condition_variable queued, finished;
+        map<string, slot> slots; ///< By path
+        deque<string> queue;     ///< Paths of QUEUED slots, in order
+        deque<string> unclaimed; ///< Paths of DONE slots, oldest first; some may be gone
+        vector<std::thread> workers;
+        bool stopping;
+        
+        /// Queue the first few subdirectories of a listing. The caller holds the lock.
+        void schedule(whole_directory *dir, unsigned depth) {
+          if (!depth)
+            return;
+          size_t n = 0;
+          for (filelist::const_iterator it = dir->dirs.begin(); it != dir->dirs.end() && n < opt.fanout; ++it, ++n) {
+            const string path = dir->path + PATH_CHAR + string(*it);
+            if (slots.count(path))
+              continue;
+            whole_directory::ref(dir);
+            slot s = { QUEUED, depth - 1, dir, NULL };
+            slots[path] = s;
+            queue.push_back(path);
           }
-#       else
-#         define PATH_CHAR "/"
-          
-          static inline bool is_directory(::dirent *file) {
-#           ifdef _DIRENT_HAVE_D_TYPE // Not standard POSIX; ask GLIBC if this system supports file->d_type
-              return file->d_type == DT_DIR;
-#           else // In the event that it does not, we have to call stat...
-              struct stat sb;
-              stat(file->d_name, &sb);
-              return sb.st_mode & S_IFDIR;
-#           endif
+          queued.notify_all();
+        }
+        
+        /// Drop a slot, with whatever it references. The caller holds the lock.
+        void drop(map<string, slot>::iterator s) {
+          if (s->second.parent)
+            whole_directory::unref(s->second.parent);
+          if (s->second.listing)
+            whole_directory::unref(s->second.listing);
+          slots.erase(s);
+        }
+        
+        void work() {
+          std::unique_lock<std::mutex> lock(mtx);
+          for (;;) {
+            queued.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (stopping)
+              return;
+            const string path = queue.front();
+            queue.pop_front();
+            map<string, slot>::iterator s = slots.find(path);
+            if (s == slots.end())
+              continue;
+            s->second.st = LISTING;
+            whole_directory *parent = s->second.parent;
+            lock.unlock();
+            whole_directory *res = whole_directory::cache(parent, path, parent->backend, parent->memory);
+            if (res)
+              whole_directory::ref(res);
+            lock.lock();
+            s = slots.find(path); // Only we may erase a LISTING slot, so it's still there
+            slot &done = s->second;
+            done.st = DONE;
+            done.listing = res;
+            whole_directory::unref(done.parent);
+            done.parent = NULL;
+            if (res)
+              schedule(res, done.depth);
+            unclaimed.push_back(path);
+            while (unclaimed.size() > size_t(MAX_UNCLAIMED)) {
+              map<string, slot>::iterator old = slots.find(unclaimed.front());
+              if (old != slots.end() && old->second.st == DONE)
+                drop(old);
+              unclaimed.pop_front();
+            }
+            finished.notify_all();
           }
-          
-          static inline whole_directory* cache(whole_directory* parent, string dirname) {
-            DIR* dir_open = ::opendir(dirname.c_str());
-            if (!dir_open) return NULL;
-            whole_directory *res = new whole_directory(parent, dirname, dir_open);
-            closedir(dir_open);
-            return res;
+        }
+        
+        public:
+        prefetcher(const prefetch_options &o): opt(o), mtx(), queued(), finished(), slots(), queue(), unclaimed(), workers(), stopping(false) {
+          for (unsigned i = 0; i < opt.workers; ++i)
+            workers.push_back(std::thread(&prefetcher::work, this));
+        }
+        ~prefetcher() {
+          {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
           }
-          
-        private:
-          whole_directory(whole_directory *prnt, string dirname, DIR* dir): parent(prnt), refs(0), path(dirname), files(), dirs() {
-            if (parent)
-              ref(parent);
-            for (::dirent* rd; (rd = readdir(dir)); ) {
-              if (is_directory(rd)) {
-                string name = rd->d_name;
-                if (name != "." and name != "..")
-                  dirs.push_back(name);
+          queued.notify_all();
+          for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+          while (!slots.empty())
+            drop(slots.begin());
+        }
+        
+        /// Note that a directory was just listed, queueing its subdirectories.
+        void listed(whole_directory *dir) {
+          std::lock_guard<std::mutex> lock(mtx);
+          schedule(dir, opt.depth);
+        }
+        
+        /// Return a referenced listing of the given subdirectory of parent:
+        /// the prefetched one if it's ready or being read, or a fresh one.
+        whole_directory *take(whole_directory *parent, const string &path) {
+          whole_directory *res = NULL;
+          bool prefetched = false;
+          {
+            std::unique_lock<std::mutex> lock(mtx);
+            map<string, slot>::iterator s = slots.find(path);
+            if (s != slots.end() && s->second.st == LISTING) {
+              finished.wait(lock, [&]() { return (s = slots.find(path)) == slots.end() || s->second.st == DONE; });
+            }
+            if (s != slots.end()) {
+              if (s->second.st == DONE && s->second.listing && s->second.listing->get_parent() == parent) {
+                res = s->second.listing;
+                s->second.listing = NULL;
+                prefetched = true;
               }
-              else files.push_back(rd->d_name);
+              else if (s->second.st == QUEUED)
+                queue.erase(std::find(queue.begin(), queue.end(), path));
+              drop(s);
             }
+            if (res)
+              schedule(res, opt.depth);
           }
-#       endif
+          if (prefetched) {
+            EFF_COUNT(STAT_CACHE_HITS, 1);
+            return res;
+          }
+          if ((res = whole_directory::cache(parent, path, parent->backend, parent->memory))) {
+            whole_directory::ref(res);
+            listed(res);
+          }
+          return res;
+        }
+        
+        private:
+        prefetcher(const prefetcher&);
+        prefetcher &operator=(const prefetcher&);
       };
       
       whole_directory *current_root;
       filelist::iterator curfile;
       filelist::iterator curdir;
+      std::shared_ptr<prefetcher> prefetch; ///< NULL unless opened with prefetch_options
       
       
       virtual string first_file() {
@@ -238,49 +512,167 @@ namespace eff {
       virtual string next_file() {
         if (curfile == current_root->files.end())
           return "";
-        return *curfile++;
+        return string(*curfile++);
       }
       
       virtual string next_directory() {
         if (curdir == current_root->dirs.end())
           return "";
-        return *curdir++;
+        return string(*curdir++);
+      }
+      
+      virtual void rewind_files()       { curfile = current_root->files.begin(); }
+      virtual void rewind_directories() { curdir = current_root->dirs.begin(); }
+      
+      static size_t fill(entry_view *out, size_t max, filelist::iterator &at, const filelist &from, entry_type type) {
+        size_t n = 0;
+        for (; n < max && at != from.end(); ++at)
+          out[n++] = entry_view(*at, type);
+        return n;
+      }
+      virtual size_t next_files(entry_view *out, size_t max) {
+        return fill(out, max, curfile, current_root->files, ENTRY_FILE);
+      }
+      virtual size_t next_directories(entry_view *out, size_t max) {
+        return fill(out, max, curdir, current_root->dirs, ENTRY_DIRECTORY);
+      }
+      virtual const entry_array &entries() const {
+        const whole_directory *d = current_root;
+        return d->views.get([d](entry_array &a) {
+          a.files.reserve(d->files.size());
+          for (filelist::const_iterator it = d->files.begin(); it != d->files.end(); ++it)
+            a.files.push_back(entry_view(*it, ENTRY_FILE));
+          a.dirs.reserve(d->dirs.size());
+          for (filelist::const_iterator it = d->dirs.begin(); it != d->dirs.end(); ++it)
+            a.dirs.push_back(entry_view(*it, ENTRY_DIRECTORY));
+        });
       }
       
       virtual size_t file_count() const { return current_root->files.size(); }
       virtual size_t directory_count() const { return current_root->dirs.size(); }
       
+      static bool listed(const filelist &names, const string &name) {
+        return std::binary_search(names.begin(), names.end(), name, name_less());
+      }
+      const folded_names &folded() const {
+        const whole_directory *d = current_root;
+        return d->folded.get([d](folded_names &n) {
+          for (filelist::const_iterator it = d->files.begin(); it != d->files.end(); ++it)
+            folded_names::add(n.files, *it);
+          for (filelist::const_iterator it = d->dirs.begin(); it != d->dirs.end(); ++it)
+            folded_names::add(n.dirs, *it);
+        });
+      }
+      /// The listed name the given one refers to, under our lookup mode.
+      string resolve_file(const string &fname) const {
+        if (lookup == LOOKUP_EXACT || listed(current_root->files, fname))
+          return fname;
+        return string(folded_names::find(folded().files, fname));
+      }
+      string resolve_directory(const string &dname) const {
+        if (lookup == LOOKUP_EXACT || listed(current_root->dirs, dname))
+          return dname;
+        return string(folded_names::find(folded().dirs, dname));
+      }
+      
+      /// Return a referenced listing of the given subdirectory.
+      whole_directory *list_child(const string &dname) const {
+        const string path = current_root->path + PATH_CHAR + dname;
+        if (prefetch)
+          return prefetch->take(current_root, path);
+        whole_directory *res = whole_directory::cache(current_root, path, current_root->backend, current_root->memory);
+        if (res)
+          whole_directory::ref(res);
+        return res;
+      }
+      
       virtual bool enter(string dname) {
-        whole_directory* new_root = whole_directory::cache(current_root, current_root->path + PATH_CHAR + dname);
+        whole_directory* new_root = list_child(resolve_directory(dname));
         if (!new_root)
           return false;
-        whole_directory::ref(new_root);
         whole_directory::unref(current_root);
         current_root = new_root;
+        curfile = current_root->files.end();
+        curdir = current_root->dirs.end();
         return true;
       }
       virtual directory_kernel *enter_new(string dname) const {
-        const string fullpath = current_root->path + PATH_CHAR + dname;
-        whole_directory* root = whole_directory::cache(current_root, fullpath);
-        return root? new kernel_filesystem(root) : NULL;
+        whole_directory* root = list_child(resolve_directory(dname));
+        if (!root)
+          return NULL;
+        kernel_filesystem *res = new kernel_filesystem(root, prefetch);
+        whole_directory::unref(root);
+        return res;
       }
       virtual bool leave() {
         if (!current_root->get_parent())
           return false;
+        EFF_COUNT(STAT_CACHE_HITS, 1); // The parent's listing is kept while we're in it
         whole_directory *old_root = current_root;
         current_root = current_root->get_parent();
         whole_directory::ref(current_root);
         whole_directory::unref(old_root);
+        curfile = current_root->files.end();
+        curdir = current_root->dirs.end();
         return true;
       }
       
-      static directory_kernel *enter_directory(string dname) {
-        whole_directory* root = whole_directory::cache(NULL, dname);
-        return root? new kernel_filesystem(root) : NULL;
+      virtual bool has_file(string fname) const {
+        return listed(current_root->files, resolve_file(fname));
+      }
+      virtual bool stat(string fname, entry_info &info) const {
+        fname = resolve_file(fname);
+        if (!listed(current_root->files, fname))
+          return false;
+        return current_root->backend->stat(current_root->path + PATH_CHAR + fname, info);
+      }
+      virtual bool read_file(string fname, content_sink &sink) const {
+        fname = resolve_file(fname);
+        if (!listed(current_root->files, fname))
+          return false;
+        return current_root->backend->read(current_root->path + PATH_CHAR + fname, sink);
+      }
+      virtual bool refresh() {
+        whole_directory* fresh = whole_directory::cache(current_root->get_parent(), current_root->path, current_root->backend, current_root->memory);
+        if (!fresh)
+          return false;
+        whole_directory::ref(fresh);
+        if (fresh->files == current_root->files && fresh->dirs == current_root->dirs) {
+          whole_directory::unref(fresh);
+          return false;
+        }
+        whole_directory::unref(current_root);
+        current_root = fresh;
+        curfile = current_root->files.end();
+        curdir = current_root->dirs.end();
+        if (prefetch)
+          prefetch->listed(current_root);
+        return true;
+      }
+      
+      virtual directory_kernel *clone() const {
+        kernel_filesystem *res = new kernel_filesystem(current_root, prefetch);
+        res->curfile = curfile;
+        res->curdir = curdir;
+        return res;
+      }
+      
+      static directory_kernel *enter_directory(string dname, const fs_backend &backend, const prefetch_options *options,
+                                               std::pmr::memory_resource *memory) {
+        whole_directory* root = whole_directory::cache(NULL, dname, &backend, mount_memory_for(memory));
+        if (!root)
+          return NULL;
+        std::shared_ptr<prefetcher> prefetch;
+        if (options && options->fanout && options->depth && options->workers) {
+          prefetch = std::make_shared<prefetcher>(*options);
+          prefetch->listed(root);
+        }
+        return new kernel_filesystem(root, prefetch);
       }
       
       ~kernel_filesystem() { whole_directory::unref(current_root); }
-      kernel_filesystem(whole_directory* dir): current_root(dir), curfile(), curdir() {
+      kernel_filesystem(whole_directory* dir, const std::shared_ptr<prefetcher> &pf):
+          current_root(dir), curfile(dir->files.end()), curdir(dir->dirs.end()), prefetch(pf) {
         whole_directory::ref(dir);
       }
       
@@ -289,24 +681,279 @@ namespace eff {
         kernel_filesystem& operator=(const kernel_filesystem&);
     };
     
-    static inline directory enter(string dir) {
-      return ctor(kernel_filesystem::enter_directory(dir));
+    static inline directory enter(string dir, const fs_backend &backend, const prefetch_options *prefetch,
+                                  std::pmr::memory_resource *memory) {
+      return ctor_charged([&]() { return kernel_filesystem::enter_directory(dir, backend, prefetch, memory); });
     }
   };
   
   /* ******************************************************************************************* *\
-  |* Zip file iteration: Call enter() on a zip file. ******************************************* *|
+  |* Nested archives: decompressed copies of zips inside zips, kept within a memory budget. **** *|
   \* ******************************************************************************************* */
   
+  class nested_archive_cache {
+    public:
+    typedef std::shared_ptr<const string> buffer;
+    
+    private:
+    struct slot {
+      buffer data;
+      std::list<string>::iterator age;
+    };
+    std::mutex mtx;
+    map<string, slot> slots;
+    std::list<string> ages; // Most recently used first
+    size_t used, budget;
+    size_t serials;
+    
+    void evict_to(size_t target) {
+      while (used > target && !ages.empty()) {
+        map<string, slot>::iterator victim = slots.find(ages.back());
+        used -= victim->second.data->size();
+        slots.erase(victim);
+        ages.pop_back();
+      }
+    }
+    
+    public:
+    nested_archive_cache(): mtx(), slots(), ages(), used(0), budget(64 << 20), serials(0) {}
+    
+    static nested_archive_cache &instance() {
+      static nested_archive_cache cache;
+      return cache;
+    }
+    
+    /// Returns a key prefix unique to one outermost archive.
+    string new_root_key() {
+      std::lock_guard<std::mutex> lock(mtx);
+      std::stringstream key;
+      key << ++serials << ':';
+      return key.str();
+    }
+    
+    buffer find(const string &key) {
+      std::lock_guard<std::mutex> lock(mtx);
+      map<string, slot>::iterator it = slots.find(key);
+      if (it == slots.end())
+        return buffer();
+      ages.splice(ages.begin(), ages, it->second.age);
+      return it->second.data;
+    }
+    
+    void insert(const string &key, const buffer &data) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (data->size() > budget || slots.count(key))
+        return;
+      evict_to(budget - data->size());
+      ages.push_front(key);
+      slot &s = slots[key];
+      s.data = data;
+      s.age = ages.begin();
+      used += data->size();
+    }
+    
+    /// Drop everything nested in the given outermost archive.
+    void purge(const string &root_key) {
+      std::lock_guard<std::mutex> lock(mtx);
+      map<string, slot>::iterator it = slots.lower_bound(root_key);
+      while (it != slots.end() && !it->first.compare(0, root_key.size(), root_key)) {
+        used -= it->second.data->size();
+        ages.erase(it->second.age);
+        slots.erase(it++);
+      }
+    }
+    
+    void set_budget(size_t bytes) {
+      std::lock_guard<std::mutex> lock(mtx);
+      budget = bytes;
+      evict_to(budget);
+    }
+  };
+  
+  void set_nested_archive_budget(size_t bytes) {
+    nested_archive_cache::instance().set_budget(bytes);
+  }
+  
+  /* ******************************************************************************************* *\
+  |* Zip file iteration: Call enter() on a zip file, or on a zip file inside one. ************** *|
+  \* ******************************************************************************************* */
+  
+  /// One open archive, shared by every kernel iterating it. The tree is
+  /// never modified once parsed; libzip calls are serialized by a lock
+  /// shared with every archive nested in the same file, since those read
+  /// through the outer archive's handle.
+  struct zip_archive {
+    zip *zfile;
+    memory_ptr memory;           ///< What tree and info are allocated from; shared with nested archives
+    parsed_directory tree;
+    std::pmr::vector<entry_info> info; ///< Each entry's metadata, by index
+    std::atomic<size_t> refs;
+    zip_archive *outer;          ///< The archive this one is nested in, if any
+    parsed_directory *outer_dir; ///< The directory in the outer archive holding this one
+    string key;                  ///< Identifies this archive among those nested in the same root
+    nested_archive_cache::buffer contents; ///< Decompressed contents, when not read in place
+    std::shared_ptr<std::mutex> lock;      ///< Guards zfile, and those of outer and nested archives
+    
+    zip_archive(zip *zf, zip_archive *o, parsed_directory *od, string k, nested_archive_cache::buffer data, const memory_ptr &mem):
+        zfile(zf), memory(mem), tree(memory.get()), info(memory.get()), refs(0), outer(o), outer_dir(od), key(k), contents(data),
+        lock(o? o->lock : std::make_shared<std::mutex>()) {
+      if (outer)
+        ref(outer);
+      const size_t count = zip_get_num_entries(zf, 0);
+      info.resize(count);
+      for (size_t i = 0; i < count; ++i) {
+        zip_stat_t st;
+        zip_stat_init(&st);
+        if (zip_stat_index(zfile, i, 0, &st) || !(st.valid & ZIP_STAT_NAME) || !st.name)
+          continue;
+        entry_info &e = info[i];
+        if (st.valid & ZIP_STAT_SIZE)        e.size = st.size,                e.valid |= entry_info::HAS_SIZE;
+        if (st.valid & ZIP_STAT_COMP_SIZE)   e.compressed_size = st.comp_size, e.valid |= entry_info::HAS_COMPRESSED_SIZE;
+        if (st.valid & ZIP_STAT_CRC)         e.crc = st.crc,                  e.valid |= entry_info::HAS_CRC;
+        if (st.valid & ZIP_STAT_MTIME)       e.mtime = st.mtime,              e.valid |= entry_info::HAS_MTIME;
+        if (st.valid & ZIP_STAT_COMP_METHOD) e.method = st.comp_method,       e.valid |= entry_info::HAS_METHOD;
+        tree.add_file(st.name, i, NULL);
+      }
+      EFF_COUNT(STAT_ENTRIES_LISTED, count);
+    }
+    ~zip_archive() {
+      {
+        std::lock_guard<std::mutex> guard(*lock);
+        zip_close(zfile);
+      }
+      if (outer)
+        unref(outer);
+      else
+        nested_archive_cache::instance().purge(key);
+    }
+    
+    static void ref(zip_archive *za) { za->refs.fetch_add(1, std::memory_order_relaxed); }
+    static void unref(zip_archive *za) {
+      if (za->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete za;
+    }
+    
+    static bool is_archive_name(std::string_view name) {
+      if (name.size() < 4) return false;
+      string ext(name.substr(name.size() - 4));
+      for (size_t i = 0; i < ext.size(); ++i)
+        ext[i] = tolower((unsigned char) ext[i]);
+      return ext == ".zip";
+    }
+    
+    /// Stream an entry to the given sink, a block at a time. The lock is
+    /// only held within libzip, so threads can read entries side by side.
+    bool read_entry(size_t index, content_sink &sink) {
+      zip_file *zf;
+      {
+        std::lock_guard<std::mutex> guard(*lock);
+        if (!(zf = zip_fopen_index(zfile, index, 0)))
+          return false;
+      }
+      char buf[64 << 10];
+      zip_int64_t got;
+      bool ok = true;
+      for (;;) {
+        {
+          std::lock_guard<std::mutex> guard(*lock);
+          got = zip_fread(zf, buf, sizeof buf);
+        }
+        if (got <= 0 || !(ok = sink.consume(buf, got)))
+          break;
+        EFF_COUNT(STAT_BYTES_DECOMPRESSED, got);
+      }
+      std::lock_guard<std::mutex> guard(*lock);
+      zip_fclose(zf);
+      return ok && !got;
+    }
+    
+    /// Read and decompress a whole entry. The caller holds the lock.
+    nested_archive_cache::buffer read_entry(size_t index, size_t size) {
+      zip_file *zf = zip_fopen_index(zfile, index, 0);
+      if (!zf) return nested_archive_cache::buffer();
+      string *data = new string(size, '\0');
+      zip_int64_t got = size? zip_fread(zf, &(*data)[0], size) : 0;
+      zip_fclose(zf);
+      if (got < 0 || size_t(got) != size) {
+        delete data;
+        return nested_archive_cache::buffer();
+      }
+      EFF_COUNT(STAT_BYTES_DECOMPRESSED, size);
+      return nested_archive_cache::buffer(data);
+    }
+    
+    /// Open a zip file in the given directory of this archive as an archive
+    /// of its own. A STORED inner archive is read in place from this one; a
+    /// compressed one is decompressed into memory, and cached.
+    zip_archive *open_nested(parsed_directory *dir, std::string_view name) {
+      parsed_directory::fileit f = dir->files.find(name);
+      if (f == dir->files.end() || !is_archive_name(name))
+        return NULL;
+      EFF_TIME(STAT_NS_OPEN_ZIP);
+      const size_t index = f->second;
+      const entry_info &st = info[index];
+      if (!(st.valid & entry_info::HAS_SIZE))
+        return NULL;
+      std::lock_guard<std::mutex> guard(*lock);
+      
+      std::stringstream kss;
+      kss << key << '/' << index;
+      const string nkey = kss.str();
+      zip_error_t err;
+      zip_error_init(&err);
+      zip *nested = NULL;
+      
+      if ((st.valid & entry_info::HAS_METHOD) && st.method == ZIP_CM_STORE) {
+        zip_source_t *window = zip_source_zip(zfile, zfile, index, 0, 0, -1);
+        if (window && !(nested = zip_open_from_source(window, ZIP_RDONLY, &err)))
+          zip_source_free(window);
+      }
+      
+      nested_archive_cache::buffer data;
+      if (!nested) { // Compressed, or libzip couldn't seek within the entry
+        nested_archive_cache &cache = nested_archive_cache::instance();
+        if ((data = cache.find(nkey)))
+          EFF_COUNT(STAT_CACHE_HITS, 1);
+        else {
+          EFF_COUNT(STAT_CACHE_MISSES, 1);
+          if (!(data = read_entry(index, st.size))) {
+            zip_error_fini(&err);
+            return NULL;
+          }
+          cache.insert(nkey, data);
+        }
+        zip_source_t *src = zip_source_buffer_create(data->data(), data->size(), 0, &err);
+        if (src && !(nested = zip_open_from_source(src, ZIP_RDONLY, &err)))
+          zip_source_free(src);
+      }
+      zip_error_fini(&err);
+      return nested? new zip_archive(nested, this, dir, nkey, data, memory) : NULL;
+    }
+    
+    private:
+      zip_archive(const zip_archive&);
+      zip_archive& operator=(const zip_archive&);
+  };
+  
   struct directory_zip: public eff::directory {
     struct kernel_zip: directory_kernel {
-      zip *zfile;
-      size_t *refs;
-      parsed_directory *tree;
+      zip_archive *archive;
       parsed_directory *curdir;
       parsed_directory::fileit file_at;
       parsed_directory::dirit dir_at;
       
+      /// Move to the given directory of the given archive.
+      void move_to(zip_archive *za, parsed_directory *dir) {
+        if (za != archive) {
+          zip_archive::ref(za);
+          zip_archive::unref(archive);
+          archive = za;
+        }
+        curdir = dir;
+        file_at = curdir->files.end();
+        dir_at = curdir->subdirs.end();
+      }
+      
       virtual string first_file() {
         file_at = curdir->files.begin();
         return next_file();
@@ -318,55 +965,128 @@ namespace eff {
       virtual string next_file() {
         if (file_at == curdir->files.end())
           return "";
-        return (file_at++)->first;
+        return string((file_at++)->first);
       }
       virtual string next_directory() {
         if (dir_at == curdir->subdirs.end())
           return "";
-        return (dir_at++)->first;
+        return string((dir_at++)->first);
+      }
+      
+      virtual void rewind_files()       { file_at = curdir->files.begin(); }
+      virtual void rewind_directories() { dir_at = curdir->subdirs.begin(); }
+      virtual size_t next_files(entry_view *out, size_t max) {
+        size_t n = 0;
+        for (; n < max && file_at != curdir->files.end(); ++file_at)
+          out[n++] = entry_view(file_at->first, ENTRY_FILE, file_at->second, &archive->info[file_at->second]);
+        return n;
+      }
+      virtual size_t next_directories(entry_view *out, size_t max) {
+        size_t n = 0;
+        for (; n < max && dir_at != curdir->subdirs.end(); ++dir_at)
+          out[n++] = entry_view(dir_at->first, ENTRY_DIRECTORY);
+        return n;
+      }
+      virtual const entry_array &entries() const {
+        const parsed_directory *d = curdir;
+        const zip_archive *za = archive;
+        return d->views.get([d, za](entry_array &a) {
+          a.files.reserve(d->files.size());
+          for (parsed_directory::filemap::const_iterator it = d->files.begin(); it != d->files.end(); ++it)
+            a.files.push_back(entry_view(it->first, ENTRY_FILE, it->second, &za->info[it->second]));
+          a.dirs.reserve(d->subdirs.size());
+          for (parsed_directory::dirmap::const_iterator it = d->subdirs.begin(); it != d->subdirs.end(); ++it)
+            a.dirs.push_back(entry_view(it->first, ENTRY_DIRECTORY));
+        });
       }
       
       virtual size_t file_count() const { return curdir->files.size(); }
       virtual size_t directory_count() const { return curdir->subdirs.size(); }
       
+      const folded_names &folded() const {
+        const parsed_directory *d = curdir;
+        return d->folded.get([d](folded_names &n) {
+          for (parsed_directory::filemap::const_iterator it = d->files.begin(); it != d->files.end(); ++it)
+            folded_names::add(n.files, it->first);
+          for (parsed_directory::dirmap::const_iterator it = d->subdirs.begin(); it != d->subdirs.end(); ++it)
+            folded_names::add(n.dirs, it->first);
+        });
+      }
+      /// The entry the given name refers to, under our lookup mode.
+      parsed_directory::fileit find_file(const string &fname) const {
+        parsed_directory::fileit f = curdir->files.find(fname);
+        if (f != curdir->files.end() || lookup == LOOKUP_EXACT)
+          return f;
+        return curdir->files.find(folded_names::find(folded().files, fname));
+      }
+      parsed_directory::dirit find_directory(const string &dname) const {
+        parsed_directory::dirit d = curdir->subdirs.find(dname);
+        if (d != curdir->subdirs.end() || lookup == LOOKUP_EXACT)
+          return d;
+        return curdir->subdirs.find(folded_names::find(folded().dirs, dname));
+      }
+      
+      /// Enter a subdirectory, or failing that, a zip file in this directory.
       virtual bool enter(string dname) {
-        parsed_directory::dirit i = curdir->subdirs.find(dname);
-        if (i == curdir->subdirs.end()) return false;
-        curdir = &i->second;
+        parsed_directory::dirit i = find_directory(dname);
+        if (i != curdir->subdirs.end()) {
+          move_to(archive, &i->second);
+          return true;
+        }
+        parsed_directory::fileit f = find_file(dname);
+        zip_archive *nested = f != curdir->files.end()? archive->open_nested(curdir, f->first) : NULL;
+        if (!nested) return false;
+        move_to(nested, &nested->tree);
         return true;
       }
       virtual directory_kernel *enter_new(string dname) const {
-        parsed_directory::dirit i = curdir->subdirs.find(dname);
-        if (i == curdir->subdirs.end()) return NULL;
-        kernel_zip *res = new kernel_zip(this);
-        res->curdir = &i->second;
-        return res;
+        parsed_directory::dirit i = find_directory(dname);
+        if (i != curdir->subdirs.end())
+          return new kernel_zip(archive, &i->second);
+        parsed_directory::fileit f = find_file(dname);
+        zip_archive *nested = f != curdir->files.end()? archive->open_nested(curdir, f->first) : NULL;
+        return nested? new kernel_zip(nested, &nested->tree) : NULL;
       }
+      /// Leave to the parent directory, which for the root of a nested
+      /// archive is the directory containing it in the outer archive.
       virtual bool leave() {
-        if (!curdir->parent) return false;
-        curdir = curdir->parent;
+        if (curdir->parent)
+          move_to(archive, curdir->parent);
+        else if (archive->outer)
+          move_to(archive->outer, archive->outer_dir);
+        else
+          return false;
         return true;
       }
-      
-      kernel_zip(zip *zf): zfile(zf), refs(new size_t(1)), tree(new parsed_directory), curdir(tree), file_at(), dir_at() {
-        vector<string> filepaths(zip_get_num_entries(zf, 0));
-        for (size_t i = 0; i < filepaths.size(); ++i) {
-          const char *fn = zip_get_name(zfile, i, 0);
-          if (fn) filepaths[i] = fn;
-          tree->add_file(fn, i, NULL);
-        }
+      virtual bool has_file(string fname) const {
+        return find_file(fname) != curdir->files.end();
       }
-      ~kernel_zip() {
-        if (!--*refs) {
-          zip_close(zfile);
-          delete tree;
-          delete refs;
-        }
+      virtual bool stat(string fname, entry_info &info) const {
+        parsed_directory::fileit f = find_file(fname);
+        if (f == curdir->files.end())
+          return false;
+        info = archive->info[f->second];
+        return true;
+      }
+      virtual bool read_file(string fname, content_sink &sink) const {
+        parsed_directory::fileit f = find_file(fname);
+        return f != curdir->files.end() && archive->read_entry(f->second, sink);
+      }
+      virtual bool refresh() {
+        return false; // The archive can't change underneath us once opened.
+      }
+      virtual directory_kernel *clone() const {
+        kernel_zip *res = new kernel_zip(archive, curdir);
+        res->file_at = file_at;
+        res->dir_at = dir_at;
+        return res;
       }
       
-      kernel_zip(const kernel_zip* dz): zfile(dz->zfile), refs(dz->refs), tree(dz->tree),
-          curdir(dz->curdir), file_at(dz->file_at), dir_at(dz->dir_at) {
-        ++*refs;
+      kernel_zip(zip_archive *za, parsed_directory *dir): archive(za), curdir(dir), file_at(), dir_at() {
+        zip_archive::ref(archive);
+      }
+      ~kernel_zip() {
+        zip_archive::unref(archive);
       }
       
       private:
@@ -376,18 +1096,42 @@ namespace eff {
     
     directory_zip(): directory(NULL) {}
     
-    static inline directory enter(string zipfile) {
+    static inline kernel_zip *open(string zipfile, std::pmr::memory_resource *memory) {
+      EFF_TIME(STAT_NS_OPEN_ZIP);
       zip *zf = zip_open(zipfile.c_str(), ZIP_CHECKCONS, 0);
-      if (!zf) return ctor(NULL);
-      return ctor(new directory_zip::kernel_zip(zf));
+      if (!zf) return NULL;
+      zip_archive *za = new zip_archive(zf, NULL, NULL, nested_archive_cache::instance().new_root_key(),
+                                        nested_archive_cache::buffer(), mount_memory_for(memory));
+      return new kernel_zip(za, &za->tree);
+    }
+    
+    static inline directory enter(string zipfile, std::pmr::memory_resource *memory) {
+      return ctor_charged([&]() { return open(zipfile, memory); });
     }
   };
   
   directory dirent_zip(string zipfile) {
-    return directory_zip::enter(zipfile);
+    return directory_zip::enter(zipfile, NULL);
   }
+  directory dirent_zip(string zipfile, std::pmr::memory_resource *memory) {
+    return directory_zip::enter(zipfile, memory);
+  }
+  
+  prefetch_options::prefetch_options(unsigned f, unsigned d, unsigned w): fanout(f), depth(d), workers(w) {}
   
   directory dirent(string dname) {
-    return directory_filesystem::enter(dname);
+    return directory_filesystem::enter(dname, fs_backend::native(), NULL, NULL);
+  }
+  directory dirent(string dname, std::pmr::memory_resource *memory) {
+    return directory_filesystem::enter(dname, fs_backend::native(), NULL, memory);
+  }
+  directory dirent(string dname, const prefetch_options &prefetch, std::pmr::memory_resource *memory) {
+    return directory_filesystem::enter(dname, fs_backend::native(), &prefetch, memory);
+  }
+  directory dirent(string dname, const fs_backend &backend, std::pmr::memory_resource *memory) {
+    return directory_filesystem::enter(dname, backend, NULL, memory);
+  }
+  directory dirent(string dname, const fs_backend &backend, const prefetch_options &prefetch, std::pmr::memory_resource *memory) {
+    return directory_filesystem::enter(dname, backend, &prefetch, memory);
   }
 }
@@ -0,0 +1,200 @@
+/**
+ * @file  gdir_diff.cpp
+ * @brief Comparison of directory trees.
+ *
+ * Implements eff::diff. Both trees are walked level by level; a file present
+ * in both is settled by metadata where possible, and otherwise queued to have
+ * its contents checksummed once the walk is done, on a pool of threads.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "gdir_diff.hpp"
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+using std::vector;
+
+namespace eff {
+  diff_options::diff_options(): trust_mtime(true), mtime_slack(2), compare_contents(true), threads(0) {}
+
+  /* ******************************************************************************************* *\
+  |* Content comparison; runs on the worker threads ******************************************** *|
+  \* ******************************************************************************************* */
+
+  struct crc_sink: content_sink {
+    uLong crc;
+    crc_sink(): crc(crc32(0, Z_NULL, 0)) {}
+    bool consume(const char *data, size_t size) {
+      crc = crc32(crc, (const Bytef*) data, size);
+      return true;
+    }
+  };
+
+  /// A file in both trees that metadata couldn't settle. Each holds its own
+  /// copies of the two directories, so workers never share a handle.
+  struct content_check {
+    directory a, b;
+    string name, path;
+    bool a_has_crc, b_has_crc; ///< Whether the archive already told us
+    uint32_t a_crc, b_crc;
+    bool read_ok, modified;
+
+    content_check(const directory &da, const directory &db, const string &n, const string &p,
+                  const entry_info &ia, const entry_info &ib):
+        a(da), b(db), name(n), path(p),
+        a_has_crc(ia.valid & entry_info::HAS_CRC), b_has_crc(ib.valid & entry_info::HAS_CRC),
+        a_crc(ia.crc), b_crc(ib.crc), read_ok(false), modified(false) {}
+
+    void run() {
+      crc_sink sa, sb;
+      read_ok = (a_has_crc || a.read_file(name, sa)) && (b_has_crc || b.read_file(name, sb));
+      modified = !read_ok || (a_has_crc? a_crc : sa.crc) != (b_has_crc? b_crc : sb.crc);
+    }
+  };
+
+  static void run_checks(vector<content_check> *checks, std::atomic<size_t> *next) {
+    for (size_t i; (i = next->fetch_add(1)) < checks->size(); )
+      (*checks)[i].run();
+  }
+
+  /* ******************************************************************************************* *\
+  |* Tree walk ********************************************************************************* *|
+  \* ******************************************************************************************* */
+
+  struct diff_walk {
+    const diff_options &opt;
+    diff_result &res;
+    vector<content_check> checks;
+
+    diff_walk(const diff_options &o, diff_result &r): opt(o), res(r), checks() {}
+
+    void report(const string &path, diff_entry::change kind, entry_type type) {
+      diff_entry e = { path, kind, type };
+      res.changes.push_back(e);
+    }
+
+    static void list(directory &d, vector<string> &files, vector<string> &dirs) {
+      entry_view batch[256];
+      size_t n;
+      d.rewind_files();
+      while ((n = d.next_files(batch)))
+        for (size_t i = 0; i < n; ++i)
+          files.push_back(batch[i].str());
+      d.rewind_directories();
+      while ((n = d.next_directories(batch)))
+        for (size_t i = 0; i < n; ++i)
+          dirs.push_back(batch[i].str());
+      std::sort(files.begin(), files.end());
+      std::sort(dirs.begin(), dirs.end());
+    }
+
+    /// Settle a file present on both sides from metadata, or queue it.
+    void compare_file(directory &a, directory &b, const string &name, const string &path) {
+      ++res.files_compared;
+      entry_info ia, ib;
+      if (a.stat(name, ia) && b.stat(name, ib)) {
+        const int both = ia.valid & ib.valid;
+        if ((both & entry_info::HAS_SIZE) && ia.size != ib.size)
+          return report(path, diff_entry::MODIFIED, ENTRY_FILE);
+        if (both & entry_info::HAS_CRC) {
+          if (ia.crc != ib.crc)
+            report(path, diff_entry::MODIFIED, ENTRY_FILE);
+          return;
+        }
+        if (opt.trust_mtime && (both & entry_info::HAS_SIZE) && (both & entry_info::HAS_MTIME)
+            && ia.mtime - ib.mtime <= opt.mtime_slack && ib.mtime - ia.mtime <= opt.mtime_slack)
+          return;
+      }
+      if (!opt.compare_contents)
+        return report(path, diff_entry::MODIFIED, ENTRY_FILE);
+      checks.push_back(content_check(a, b, name, path, ia, ib));
+    }
+
+    void compare_level(directory &a, directory &b, const string &prefix) {
+      vector<string> afiles, adirs, bfiles, bdirs;
+      list(a, afiles, adirs);
+      list(b, bfiles, bdirs);
+
+      for (size_t i = 0, j = 0; i < afiles.size() || j < bfiles.size(); ) {
+        if (j == bfiles.size() || (i < afiles.size() && afiles[i] < bfiles[j]))
+          report(prefix + afiles[i++], diff_entry::REMOVED, ENTRY_FILE);
+        else if (i == afiles.size() || bfiles[j] < afiles[i])
+          report(prefix + bfiles[j++], diff_entry::ADDED, ENTRY_FILE);
+        else {
+          compare_file(a, b, afiles[i], prefix + afiles[i]);
+          ++i, ++j;
+        }
+      }
+
+      for (size_t i = 0, j = 0; i < adirs.size() || j < bdirs.size(); ) {
+        if (j == bdirs.size() || (i < adirs.size() && adirs[i] < bdirs[j]))
+          report(prefix + adirs[i++], diff_entry::REMOVED, ENTRY_DIRECTORY);
+        else if (i == adirs.size() || bdirs[j] < adirs[i])
+          report(prefix + bdirs[j++], diff_entry::ADDED, ENTRY_DIRECTORY);
+        else {
+          directory suba = a.enter_new(adirs[i]), subb = b.enter_new(bdirs[j]);
+          if (suba.good() && subb.good())
+            compare_level(suba, subb, prefix + adirs[i] + "/");
+          else
+            res.complete = false;
+          ++i, ++j;
+        }
+      }
+    }
+
+    void check_contents() {
+      unsigned nthreads = opt.threads? opt.threads : std::thread::hardware_concurrency();
+      if (!nthreads)
+        nthreads = 1;
+      std::atomic<size_t> next(0);
+      vector<std::thread> workers;
+      for (unsigned t = 1; t < nthreads && t < checks.size(); ++t)
+        workers.push_back(std::thread(run_checks, &checks, &next));
+      run_checks(&checks, &next);
+      for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+
+      res.files_read = checks.size();
+      for (size_t i = 0; i < checks.size(); ++i) {
+        if (!checks[i].read_ok)
+          res.complete = false;
+        if (checks[i].modified)
+          report(checks[i].path, diff_entry::MODIFIED, ENTRY_FILE);
+      }
+    }
+  };
+
+  static bool by_path(const diff_entry &x, const diff_entry &y) {
+    return x.path < y.path;
+  }
+
+  diff_result diff(const directory &a, const directory &b, const diff_options &options) {
+    diff_result res;
+    res.files_compared = res.files_read = 0;
+    res.complete = a.good() && b.good();
+    if (!res.complete)
+      return res;
+    directory da = a, db = b;
+    diff_walk walk(options, res);
+    walk.compare_level(da, db, "");
+    walk.check_contents();
+    std::sort(res.changes.begin(), res.changes.end(), by_path);
+    return res;
+  }
+}
@@ -0,0 +1,196 @@
+/**
+ * @file  gdir_memory.cpp
+ * @brief A directory tree held in memory, for dirent() to read.
+ *
+ * Implements eff::memory_backend. Each directory is kept by its normalized
+ * path; latency is simulated by sleeping before the lock is taken, so calls
+ * from several threads wait side by side.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "gdir_memory.hpp"
+#include <thread>
+#include <algorithm>
+#include <ctime>
+
+namespace eff {
+  memory_backend::memory_backend():
+      mtx(), tree(), list_latency(0), stat_latency(0), read_latency(0), lists(0), stats(0), reads(0) {
+    tree[""];
+  }
+
+  string memory_backend::normalize(const string &path) {
+    string res;
+    for (size_t i = 0; i < path.size(); ) {
+      size_t end = path.find_first_of("/\\", i);
+      if (end == string::npos)
+        end = path.size();
+      if (end > i && path.compare(i, end - i, ".")) {
+        if (!res.empty())
+          res += '/';
+        res.append(path, i, end - i);
+      }
+      i = end + 1;
+    }
+    return res;
+  }
+
+  /// Split a normalized path into its directory and its last name.
+  static void split(const string &path, string &dir, string &name) {
+    const size_t slash = path.rfind('/');
+    dir = slash == string::npos? string() : path.substr(0, slash);
+    name = path.substr(slash == string::npos? 0 : slash + 1);
+  }
+
+  static void wait(std::chrono::nanoseconds latency) {
+    if (latency.count() > 0)
+      std::this_thread::sleep_for(latency);
+  }
+
+  /* ******************************************************************************************* *\
+  |* Building the tree ************************************************************************* *|
+  \* ******************************************************************************************* */
+
+  memory_backend::dir_node &memory_backend::make_directory(const string &path) {
+    std::map<string, dir_node>::iterator it = tree.find(path);
+    if (it != tree.end())
+      return it->second;
+    string parent, name;
+    split(path, parent, name);
+    dir_node &up = make_directory(parent);
+    up.files.erase(name);
+    up.dirs.insert(name);
+    return tree[path];
+  }
+
+  void memory_backend::add_file(const string &path, const string &contents) {
+    string dir, name;
+    split(normalize(path), dir, name);
+    if (name.empty())
+      return;
+    file_node f = { std::make_shared<const string>(contents), int64_t(std::time(NULL)) };
+    std::lock_guard<std::mutex> lock(mtx);
+    dir_node &d = make_directory(dir);
+    if (d.dirs.count(name))
+      remove_entry(dir.empty()? name : dir + "/" + name);
+    d.files[name] = f;
+  }
+
+  void memory_backend::add_directory(const string &path) {
+    std::lock_guard<std::mutex> lock(mtx);
+    make_directory(normalize(path));
+  }
+
+  bool memory_backend::remove(const string &path) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return remove_entry(normalize(path));
+  }
+
+  bool memory_backend::remove_entry(const string &norm) {
+    string dir, name;
+    split(norm, dir, name);
+    std::map<string, dir_node>::iterator d = tree.find(dir);
+    if (name.empty() || d == tree.end())
+      return false;
+    if (d->second.files.erase(name))
+      return true;
+    if (!d->second.dirs.erase(name))
+      return false;
+    tree.erase(norm);
+    const string prefix = norm + "/";
+    std::map<string, dir_node>::iterator it = tree.lower_bound(prefix);
+    while (it != tree.end() && !it->first.compare(0, prefix.size(), prefix))
+      tree.erase(it++);
+    return true;
+  }
+
+  void memory_backend::set_latency(std::chrono::nanoseconds list, std::chrono::nanoseconds stat, std::chrono::nanoseconds read) {
+    std::lock_guard<std::mutex> lock(mtx);
+    list_latency = list;
+    stat_latency = stat;
+    read_latency = read;
+  }
+
+  /* ******************************************************************************************* *\
+  |* Serving it ******************************************************************************** *|
+  \* ******************************************************************************************* */
+
+  bool memory_backend::list(const string &path, listing_sink &sink) const {
+    ++lists;
+    std::unique_lock<std::mutex> lock(mtx);
+    const std::chrono::nanoseconds latency = list_latency;
+    lock.unlock();
+    wait(latency);
+    lock.lock();
+    std::map<string, dir_node>::const_iterator d = tree.find(normalize(path));
+    if (d == tree.end())
+      return false;
+    for (std::map<string, file_node>::const_iterator it = d->second.files.begin(); it != d->second.files.end(); ++it)
+      sink.add(it->first.c_str(), false);
+    for (std::set<string>::const_iterator it = d->second.dirs.begin(); it != d->second.dirs.end(); ++it)
+      sink.add(it->c_str(), true);
+    return true;
+  }
+
+  bool memory_backend::stat(const string &path, entry_info &info) const {
+    ++stats;
+    std::unique_lock<std::mutex> lock(mtx);
+    const std::chrono::nanoseconds latency = stat_latency;
+    lock.unlock();
+    wait(latency);
+    string dir, name;
+    split(normalize(path), dir, name);
+    lock.lock();
+    std::map<string, dir_node>::const_iterator d = tree.find(dir);
+    if (d == tree.end())
+      return false;
+    std::map<string, file_node>::const_iterator f = d->second.files.find(name);
+    if (f == d->second.files.end())
+      return false;
+    info = entry_info();
+    info.size = info.compressed_size = f->second.contents->size();
+    info.mtime = f->second.mtime;
+    info.valid = entry_info::HAS_SIZE | entry_info::HAS_COMPRESSED_SIZE | entry_info::HAS_MTIME | entry_info::HAS_METHOD;
+    return true;
+  }
+
+  bool memory_backend::read(const string &path, content_sink &sink) const {
+    ++reads;
+    std::unique_lock<std::mutex> lock(mtx);
+    const std::chrono::nanoseconds latency = read_latency;
+    lock.unlock();
+    wait(latency);
+    string dir, name;
+    split(normalize(path), dir, name);
+    contents_ptr contents;
+    lock.lock();
+    std::map<string, dir_node>::const_iterator d = tree.find(dir);
+    if (d == tree.end())
+      return false;
+    std::map<string, file_node>::const_iterator f = d->second.files.find(name);
+    if (f == d->second.files.end())
+      return false;
+    contents = f->second.contents;
+    lock.unlock();
+    // Hand it over a block at a time, as a file on disk would be.
+    const size_t block = 64 << 10;
+    for (size_t at = 0; at < contents->size(); at += block)
+      if (!sink.consume(contents->data() + at, std::min(block, contents->size() - at)))
+        return false;
+    return true;
+  }
+}
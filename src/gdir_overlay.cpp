@@ -0,0 +1,349 @@
+/**
+ * @file  gdir_overlay.cpp
+ * @brief Union directory access.
+ *
+ * Implements a directory kernel presenting several directories, such as a
+ * loose-file override folder and a stack of zip packs, as a single tree.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "gdir.hpp"
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+using std::vector;
+using std::map;
+using eff::listing_detail::folded_names;
+using eff::listing_detail::entry_array;
+using eff::listing_detail::lazy_slot;
+
+namespace eff {
+
+  /* ******************************************************************************************* *\
+  |* Overlay iteration: each level of the tree is merged once, the first time it's visited. **** *|
+  \* ******************************************************************************************* */
+
+  struct directory_overlay: public eff::directory {
+    typedef map<string, size_t> namemap; // Entry name -> index of the layer providing it
+    typedef vector<string> namelist;
+
+    /// The merged listing of one level as of one sync. Never modified once
+    /// built, so kernels can iterate it while a newer one replaces it.
+    struct merged_listing {
+      namemap files;
+      namemap dirs;
+      lazy_slot<folded_names> folded;
+      lazy_slot<entry_array> views;
+    };
+    typedef std::shared_ptr<const merged_listing> listing_ptr;
+
+    /// One directory level of the merged tree. Guarded by its tree's lock.
+    struct overlay_level {
+      overlay_level *parent;
+      string name;
+
+      vector<directory> layers;   ///< This level in each layer; bad where a layer lacks it
+      vector<size_t> built;       ///< The generation of each layer when it was last listed
+      vector<namelist> layer_files;
+      vector<namelist> layer_dirs;
+
+      listing_ptr merged;
+      map<string, overlay_level*> children;
+
+      overlay_level(overlay_level *p, string n, size_t nlayers):
+          parent(p), name(n), layers(nlayers, bad_directory()), built(nlayers, size_t(-1)),
+          layer_files(nlayers), layer_dirs(nlayers), merged(std::make_shared<merged_listing>()), children() {}
+      ~overlay_level() {
+        for (map<string, overlay_level*>::iterator it = children.begin(); it != children.end(); ++it)
+          delete it->second;
+      }
+
+      /// Re-read whichever layers have changed since this level was built,
+      /// then rebuild the merged index from the per-layer listings.
+      void sync(const vector<size_t> &generation) {
+        if (parent)
+          parent->sync(generation);
+        bool stale = false;
+        for (size_t l = 0; l < layers.size(); ++l) {
+          if (built[l] == generation[l])
+            continue;
+          if (parent) {
+            const namelist &pd = parent->layer_dirs[l];
+            bool present = std::find(pd.begin(), pd.end(), name) != pd.end();
+            layers[l] = present? parent->layers[l].enter_new(name) : bad_directory();
+          }
+          else if (built[l] != size_t(-1) && layers[l].good())
+            layers[l].refresh();
+          relist(l, generation[l]);
+          stale = true;
+        }
+        if (stale)
+          merge();
+      }
+
+      /// Re-read one layer's listing from its handle at this level.
+      void relist(size_t l, size_t gen) {
+        built[l] = gen;
+        layer_files[l].clear();
+        layer_dirs[l].clear();
+        directory &d = layers[l];
+        if (!d.good())
+          return;
+        for (string f = d.first_file(); !f.empty(); f = d.next_file())
+          layer_files[l].push_back(f);
+        for (string f = d.first_directory(); !f.empty(); f = d.next_directory())
+          layer_dirs[l].push_back(f);
+      }
+
+      /// Build the merged listing, from the last layer up, so that each name
+      /// ends up with the first layer providing it, as a file or directory.
+      void merge() {
+        std::shared_ptr<merged_listing> m = std::make_shared<merged_listing>();
+        for (size_t l = layers.size(); l--; ) {
+          for (namelist::iterator it = layer_files[l].begin(); it != layer_files[l].end(); ++it) {
+            m->dirs.erase(*it);
+            m->files[*it] = l;
+          }
+          for (namelist::iterator it = layer_dirs[l].begin(); it != layer_dirs[l].end(); ++it) {
+            m->files.erase(*it);
+            m->dirs[*it] = l;
+          }
+        }
+        merged = m;
+      }
+
+      private:
+      overlay_level(const overlay_level&);
+      overlay_level &operator=(const overlay_level&);
+    };
+
+    /// The merged tree, shared by every kernel entered from the same overlay.
+    struct overlay_tree {
+      std::mutex lock;           ///< Guards the generations, and every level
+      vector<size_t> generation; ///< Bumped for a layer whenever it changes
+      overlay_level root;
+      std::atomic<size_t> refs;
+
+      overlay_tree(const vector<directory> &layers):
+          lock(), generation(layers.size(), 0), root(NULL, "", layers.size()), refs(0) {
+        root.layers = layers;
+      }
+    };
+
+    struct kernel_overlay: directory_kernel {
+      overlay_tree *tree;
+      overlay_level *current;
+      listing_ptr listing; ///< Our snapshot of the current level's listing
+      namemap::const_iterator file_at;
+      namemap::const_iterator dir_at;
+
+      /// Move to the given level, first catching it up with any layer that
+      /// changed since it was last visited. The caller holds the tree's lock.
+      void visit(overlay_level *lv) {
+        lv->sync(tree->generation);
+        current = lv;
+        listing = lv->merged;
+        file_at = listing->files.end();
+        dir_at = listing->dirs.end();
+      }
+
+      /// The caller holds the tree's lock.
+      overlay_level *child(string dname) const {
+        if (listing->dirs.find(dname) == listing->dirs.end())
+          return NULL;
+        overlay_level *&res = current->children[dname];
+        if (!res)
+          res = new overlay_level(current, dname, tree->generation.size());
+        return res;
+      }
+
+      virtual string first_file() {
+        file_at = listing->files.begin();
+        return next_file();
+      }
+      virtual string first_directory() {
+        dir_at = listing->dirs.begin();
+        return next_directory();
+      }
+      virtual string next_file() {
+        if (file_at == listing->files.end())
+          return "";
+        return (file_at++)->first;
+      }
+      virtual string next_directory() {
+        if (dir_at == listing->dirs.end())
+          return "";
+        return (dir_at++)->first;
+      }
+
+      virtual void rewind_files()       { file_at = listing->files.begin(); }
+      virtual void rewind_directories() { dir_at = listing->dirs.begin(); }
+
+      static size_t fill(entry_view *out, size_t max, namemap::const_iterator &at, const namemap &from, entry_type type) {
+        size_t n = 0;
+        for (; n < max && at != from.end(); ++at)
+          out[n++] = entry_view(at->first, type);
+        return n;
+      }
+      virtual size_t next_files(entry_view *out, size_t max) {
+        return fill(out, max, file_at, listing->files, ENTRY_FILE);
+      }
+      virtual size_t next_directories(entry_view *out, size_t max) {
+        return fill(out, max, dir_at, listing->dirs, ENTRY_DIRECTORY);
+      }
+      virtual const entry_array &entries() const {
+        const merged_listing *m = listing.get();
+        return m->views.get([m](entry_array &a) {
+          a.files.reserve(m->files.size());
+          for (namemap::const_iterator it = m->files.begin(); it != m->files.end(); ++it)
+            a.files.push_back(entry_view(it->first, ENTRY_FILE));
+          a.dirs.reserve(m->dirs.size());
+          for (namemap::const_iterator it = m->dirs.begin(); it != m->dirs.end(); ++it)
+            a.dirs.push_back(entry_view(it->first, ENTRY_DIRECTORY));
+        });
+      }
+
+      virtual size_t file_count() const { return listing->files.size(); }
+      virtual size_t directory_count() const { return listing->dirs.size(); }
+
+      const folded_names &folded() const {
+        const merged_listing *m = listing.get();
+        return m->folded.get([m](folded_names &n) {
+          for (namemap::const_iterator it = m->files.begin(); it != m->files.end(); ++it)
+            folded_names::add(n.files, it->first);
+          for (namemap::const_iterator it = m->dirs.begin(); it != m->dirs.end(); ++it)
+            folded_names::add(n.dirs, it->first);
+        });
+      }
+      /// The merged name the given one refers to, under our lookup mode.
+      string resolve_file(const string &fname) const {
+        if (lookup == LOOKUP_EXACT || listing->files.count(fname))
+          return fname;
+        return string(folded_names::find(folded().files, fname));
+      }
+      string resolve_directory(const string &dname) const {
+        if (lookup == LOOKUP_EXACT || listing->dirs.count(dname))
+          return dname;
+        return string(folded_names::find(folded().dirs, dname));
+      }
+
+      virtual bool enter(string dname) {
+        dname = resolve_directory(dname);
+        std::lock_guard<std::mutex> guard(tree->lock);
+        overlay_level *lv = child(dname);
+        if (!lv) return false;
+        visit(lv);
+        return true;
+      }
+      virtual directory_kernel *enter_new(string dname) const {
+        dname = resolve_directory(dname);
+        overlay_level *lv;
+        {
+          std::lock_guard<std::mutex> guard(tree->lock);
+          lv = child(dname);
+        }
+        return lv? new kernel_overlay(tree, lv) : NULL;
+      }
+      virtual bool leave() {
+        if (!current->parent) return false;
+        std::lock_guard<std::mutex> guard(tree->lock);
+        visit(current->parent);
+        return true;
+      }
+      virtual bool has_file(string fname) const {
+        return listing->files.find(resolve_file(fname)) != listing->files.end();
+      }
+      /// Ask whichever layer provides the file.
+      virtual bool stat(string fname, entry_info &info) const {
+        fname = resolve_file(fname);
+        namemap::const_iterator f = listing->files.find(fname);
+        if (f == listing->files.end())
+          return false;
+        std::lock_guard<std::mutex> guard(tree->lock);
+        const directory &layer = current->layers[f->second];
+        return layer.good() && layer.stat(fname, info);
+      }
+      virtual bool read_file(string fname, content_sink &sink) const {
+        fname = resolve_file(fname);
+        namemap::const_iterator f = listing->files.find(fname);
+        if (f == listing->files.end())
+          return false;
+        directory layer = bad_directory();
+        {
+          std::lock_guard<std::mutex> guard(tree->lock);
+          layer = current->layers[f->second]; // Our own copy, to read without the lock
+        }
+        return layer.good() && layer.read_file(fname, sink);
+      }
+
+      /// Refresh each layer at this level. A layer that changed is marked
+      /// stale everywhere, but other levels only re-read it when visited.
+      virtual bool refresh() {
+        std::lock_guard<std::mutex> guard(tree->lock);
+        bool changed = false;
+        for (size_t l = 0; l < current->layers.size(); ++l)
+          if (current->layers[l].good() && current->layers[l].refresh()) {
+            current->relist(l, ++tree->generation[l]);
+            changed = true;
+          }
+        if (changed) {
+          current->merge();
+          visit(current);
+        }
+        return changed;
+      }
+
+      virtual directory_kernel *clone() const {
+        return new kernel_overlay(*this);
+      }
+
+      kernel_overlay(overlay_tree *t, overlay_level *lv): tree(t), current(NULL), listing(), file_at(), dir_at() {
+        tree->refs.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> guard(tree->lock);
+        visit(lv);
+      }
+      ~kernel_overlay() {
+        if (tree->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          delete tree;
+      }
+
+      private:
+        kernel_overlay(const kernel_overlay &k):
+            directory_kernel(), tree(k.tree), current(k.current), listing(k.listing), file_at(k.file_at), dir_at(k.dir_at) {
+          tree->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        kernel_overlay& operator=(const kernel_overlay&);
+    };
+
+    static inline directory bad_directory() {
+      return ctor(NULL);
+    }
+
+    static inline directory enter(const vector<directory> &layers) {
+      overlay_tree *tree = new overlay_tree(layers);
+      return ctor_charged([&]() { return new kernel_overlay(tree, &tree->root); });
+    }
+  };
+
+  directory dirent_overlay(const std::vector<directory> &layers) {
+    return directory_overlay::enter(layers);
+  }
+}
@@ -0,0 +1,492 @@
+/**
+ * @file  zip_writer.cpp
+ * @brief Zip archive creation.
+ *
+ * Implements the writer declared in zip_writer.hpp. Entries are compressed
+ * with raw deflate streams from zlib on worker threads, each independently of
+ * the others, and written out in the order they were added. Only a bounded
+ * window of compressed entries is held in memory at once.
+ *
+ * @section License
+ * Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "zip_writer.hpp"
+#include "gdir.hpp"
+#include <zlib.h>
+#include <ctime>
+#include <cctype>
+#include <fstream>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdio>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using std::vector;
+
+namespace eff {
+
+  /* ******************************************************************************************* *\
+  |* Little-endian record building ************************************************************** *|
+  \* ******************************************************************************************* */
+
+  static inline void put16(string &s, uint16_t v) {
+    s += char(v); s += char(v >> 8);
+  }
+  static inline void put32(string &s, uint32_t v) {
+    put16(s, v); put16(s, v >> 16);
+  }
+  static inline void put64(string &s, uint64_t v) {
+    put32(s, v); put32(s, v >> 32);
+  }
+
+  static void dos_datetime(time_t t, uint16_t &dos_time, uint16_t &dos_date) {
+    struct tm *lt = localtime(&t);
+    if (!lt || lt->tm_year < 80) {
+      dos_time = 0;
+      dos_date = (1 << 5) | 1; // 1980-01-01
+      return;
+    }
+    dos_time = lt->tm_hour << 11 | lt->tm_min << 5 | lt->tm_sec >> 1;
+    dos_date = (lt->tm_year - 80) << 9 | (lt->tm_mon + 1) << 5 | lt->tm_mday;
+  }
+
+  static string lowercase_extension(const string &name) {
+    size_t dot = name.find_last_of('.'), slash = name.find_last_of('/');
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+      return "";
+    string ext = name.substr(dot);
+    for (size_t i = 0; i < ext.size(); ++i)
+      ext[i] = tolower((unsigned char) ext[i]);
+    return ext;
+  }
+
+  static const uint32_t ZIP64_LIMIT = 0xFFFFFFFFu;
+
+  /* ******************************************************************************************* *\
+  |* Entry compression; runs on the worker threads ********************************************** *|
+  \* ******************************************************************************************* */
+
+  /// An entry's contents, as they will appear in the archive. Stored entries
+  /// are copied from their source as they're written, so aren't held here.
+  struct packed_entry {
+    string data;  ///< The deflated contents; empty if stored
+    uint64_t size;
+    uint32_t crc;
+    uint16_t method;
+    bool ok;
+    bool ready;
+    packed_entry(): data(), size(0), crc(0), method(0), ok(false), ready(false) {}
+  };
+
+  /// The most handed to zlib, or read from a file, at once. zlib counts in
+  /// 32-bit uInt, so nothing of 4 GiB or more may be given to it whole.
+  static const size_t BLOCK_SIZE = 1 << 20;
+
+  static uLong crc_update(uLong crc, const char *data, size_t size) {
+    for (size_t n; size; data += n, size -= n)
+      crc = crc32(crc, (const Bytef*) data, n = std::min(size, BLOCK_SIZE));
+    return crc;
+  }
+
+  /// A raw deflate stream into a string, fed a block at a time. Gives up as
+  /// soon as the output grows past the given limit, as it isn't worth it.
+  class raw_deflater {
+    z_stream zs;
+    string &out;
+    size_t used, limit;
+    bool good;
+
+    bool run(const char *data, size_t size, int flush) {
+      zs.next_in = (Bytef*) data;
+      zs.avail_in = size;
+      for (;;) {
+        if (out.size() - used < BLOCK_SIZE / 16)
+          out.resize(std::max(out.size() * 2, used + BLOCK_SIZE / 16));
+        const size_t room = std::min(out.size() - used, BLOCK_SIZE);
+        zs.next_out = (Bytef*) &out[used];
+        zs.avail_out = room;
+        const int res = deflate(&zs, flush);
+        used += room - zs.avail_out;
+        if (used > limit || (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR))
+          return good = false;
+        if (res == Z_STREAM_END || (flush != Z_FINISH && !zs.avail_in && zs.avail_out))
+          return true;
+      }
+    }
+
+    public:
+    raw_deflater(string &o, int level, size_t max_out): zs(), out(o), used(0), limit(max_out), good(true) {
+      zs.zalloc = Z_NULL;
+      zs.zfree = Z_NULL;
+      zs.opaque = Z_NULL;
+      good = deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~raw_deflater() {
+      deflateEnd(&zs);
+    }
+
+    bool write(const char *data, size_t size) {
+      for (size_t n; good && size; data += n, size -= n)
+        run(data, n = std::min(size, BLOCK_SIZE), Z_NO_FLUSH);
+      return good;
+    }
+    bool finish() {
+      if (good && run(NULL, 0, Z_FINISH)) {
+        out.resize(used);
+        out.shrink_to_fit();
+      }
+      return good;
+    }
+
+    private:
+    raw_deflater(const raw_deflater&);
+    raw_deflater &operator=(const raw_deflater&);
+  };
+
+  /// The state shared between the writer and its workers while packing. A
+  /// worker claims the next entry, provided it's within the window of entries
+  /// the writer may have to hold, and compresses it without holding the lock.
+  struct zip_pack_job {
+    const zip_writer &zw;
+    vector<packed_entry> packed;
+    size_t window;
+    size_t next, written;
+    bool failed;
+    std::mutex mtx;
+    std::condition_variable entry_ready, window_moved;
+
+    zip_pack_job(const zip_writer &w, size_t win):
+        zw(w), packed(w.entries.size()), window(win), next(0), written(0), failed(false),
+        mtx(), entry_ready(), window_moved() {}
+
+    /// Hand an entry's contents to the given function a block at a time,
+    /// from memory or streamed from disk.
+    template<class F> static bool read_blocks(const zip_writer::entry &e, F f) {
+      if (e.path.empty()) {
+        for (size_t at = 0; at < e.data.size(); at += BLOCK_SIZE)
+          f(e.data.data() + at, std::min(e.data.size() - at, BLOCK_SIZE));
+        return true;
+      }
+      std::ifstream in(e.path.c_str(), std::ios::in | std::ios::binary);
+      if (!in)
+        return false;
+      vector<char> buf(BLOCK_SIZE);
+      while (in.read(&buf[0], buf.size()) || in.gcount())
+        f(&buf[0], size_t(in.gcount()));
+      return !in.bad();
+    }
+
+    /// Checksum an entry, and deflate it if the policy and its contents
+    /// make that worthwhile.
+    void pack(const zip_writer::entry &e, packed_entry &p) const {
+      p.ok = true;
+      if (e.is_dir)
+        return;
+      uint64_t size = e.data.size();
+      struct stat sb;
+      if (!e.path.empty()) {
+        if (stat(e.path.c_str(), &sb)) {
+          p.ok = false;
+          return;
+        }
+        size = sb.st_size;
+      }
+      p.method = zw.choose_method(e, size);
+      raw_deflater deflater(p.data, zw.pol.level, size);
+      bool deflating = p.method == zip_writer::DEFLATE;
+      uLong crc = crc32(0, Z_NULL, 0);
+      p.ok = read_blocks(e, [&](const char *data, size_t n) {
+        crc = crc_update(crc, data, n);
+        p.size += n;
+        if (deflating)
+          deflating = deflater.write(data, n);
+      });
+      p.crc = crc;
+      if (deflating && deflater.finish() && p.data.size() < p.size)
+        return;
+      p.method = zip_writer::STORED;
+      string().swap(p.data);
+    }
+
+    void work() {
+      for (;;) {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (next < packed.size() && !failed && next >= written + window)
+          window_moved.wait(lock);
+        if (next >= packed.size() || failed)
+          return;
+        size_t i = next++;
+        lock.unlock();
+
+        packed_entry p;
+        pack(zw.entries[i], p);
+
+        p.ready = true;
+        lock.lock();
+        std::swap(packed[i], p);
+        entry_ready.notify_all();
+      }
+    }
+
+    static void run(zip_pack_job *job) { job->work(); }
+
+    /// Wait for the given entry to be packed, and take its contents.
+    void take(size_t i, packed_entry &p) {
+      std::unique_lock<std::mutex> lock(mtx);
+      while (!packed[i].ready)
+        entry_ready.wait(lock);
+      std::swap(p, packed[i]);
+    }
+
+    /// Let the workers move on past an entry that has been written.
+    void advance(bool ok) {
+      std::lock_guard<std::mutex> lock(mtx);
+      ++written;
+      failed |= !ok;
+      window_moved.notify_all();
+    }
+
+    private:
+    zip_pack_job(const zip_pack_job&);
+    zip_pack_job &operator=(const zip_pack_job&);
+  };
+
+  /* ******************************************************************************************* *\
+  |* The writer ********************************************************************************* *|
+  \* ******************************************************************************************* */
+
+  zip_writer::policy::policy(): stored_extensions(), store_below(64), level(Z_DEFAULT_COMPRESSION) {
+    static const char *const precompressed[] = {
+      ".png", ".jpg", ".jpeg", ".gif", ".webp", ".ogg", ".mp3", ".flac", ".zip", ".gz", ".7z", ".xz", ".bz2"
+    };
+    for (size_t i = 0; i < sizeof precompressed / sizeof *precompressed; ++i)
+      stored_extensions.insert(precompressed[i]);
+  }
+
+  zip_writer::zip_writer(string zf, unsigned nthreads):
+      zipfile(zf), threads(nthreads), pol(), entries(), closed(false) {
+    if (!threads)
+      threads = std::thread::hardware_concurrency();
+    if (!threads)
+      threads = 1;
+  }
+
+  zip_writer::~zip_writer() {}
+
+  void zip_writer::add_file(string name, string path, method m) {
+    entry e = { name, path, "", m, 0, 0, false };
+    struct stat sb;
+    dos_datetime(stat(path.c_str(), &sb)? time(NULL) : sb.st_mtime, e.dos_time, e.dos_date);
+    entries.push_back(e);
+  }
+
+  void zip_writer::add_memory(string name, string data, method m) {
+    entry e = { name, "", "", m, 0, 0, false };
+    e.data.swap(data);
+    dos_datetime(time(NULL), e.dos_time, e.dos_date);
+    entries.push_back(e);
+  }
+
+  void zip_writer::add_directory(string name) {
+    if (name.empty() || name[name.size() - 1] != '/')
+      name += '/';
+    entry e = { name, "", "", STORED, 0, 0, true };
+    dos_datetime(time(NULL), e.dos_time, e.dos_date);
+    entries.push_back(e);
+  }
+
+  static void add_tree_from(zip_writer &zw, directory dir, const string &path, const string &prefix) {
+    for (string fn = dir.first_file(); !fn.empty(); fn = dir.next_file())
+      zw.add_file(prefix + fn, path + "/" + fn);
+    for (string dn = dir.first_directory(); !dn.empty(); dn = dir.next_directory()) {
+      directory sub = dir.enter_new(dn);
+      zw.add_directory(prefix + dn + "/");
+      if (sub.good())
+        add_tree_from(zw, sub, path + "/" + dn, prefix + dn + "/");
+    }
+  }
+
+  bool zip_writer::add_tree(string path, string prefix) {
+    directory dir = dirent(path);
+    if (!dir.good())
+      return false;
+    if (!prefix.empty() && prefix[prefix.size() - 1] != '/')
+      prefix += '/';
+    add_tree_from(*this, dir, path, prefix);
+    return true;
+  }
+
+  int zip_writer::choose_method(const entry &e, uint64_t size) const {
+    if (e.method != AUTO)
+      return e.method;
+    if (size < pol.store_below || pol.stored_extensions.count(lowercase_extension(e.name)))
+      return STORED;
+    return DEFLATE;
+  }
+
+  bool zip_writer::close() {
+    if (closed)
+      return false;
+    closed = true;
+
+    std::ofstream out(zipfile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    if (!write_archive(out)) {
+      out.close();
+      std::remove(zipfile.c_str());
+      return false;
+    }
+    out.close();
+    if (out.fail()) {
+      std::remove(zipfile.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool zip_writer::write_archive(std::ostream &out) const {
+
+    zip_pack_job job(*this, 4 * threads);
+    vector<std::thread> workers;
+    for (unsigned i = 0; i < threads && i < entries.size(); ++i)
+      workers.push_back(std::thread(zip_pack_job::run, &job));
+
+    // Write each entry as soon as it and everything before it is packed,
+    // building the central directory as we go.
+    bool ok = true;
+    uint64_t offset = 0;
+    string central, rec;
+    for (size_t i = 0; i < entries.size() && ok; ++i) {
+      const entry &e = entries[i];
+      packed_entry p;
+      job.take(i, p);
+      ok = p.ok;
+      if (ok) {
+        const uint64_t csize = p.method == STORED? p.size : p.data.size();
+        const bool big_data = p.size >= ZIP64_LIMIT || csize >= ZIP64_LIMIT;
+        const bool big = big_data || offset >= ZIP64_LIMIT;
+        const uint16_t version = big? 45 : 20;
+
+        rec.clear();
+        put32(rec, 0x04034b50);
+        put16(rec, version);
+        put16(rec, 0x0800); // Names are UTF-8
+        put16(rec, p.method);
+        put16(rec, e.dos_time);
+        put16(rec, e.dos_date);
+        put32(rec, p.crc);
+        put32(rec, big_data? ZIP64_LIMIT : csize);
+        put32(rec, big_data? ZIP64_LIMIT : p.size);
+        put16(rec, e.name.size());
+        put16(rec, big_data? 20 : 0);
+        rec += e.name;
+        if (big_data) {
+          put16(rec, 0x0001);
+          put16(rec, 16);
+          put64(rec, p.size);
+          put64(rec, csize);
+        }
+        out.write(rec.data(), rec.size());
+        if (p.method == STORED && !e.is_dir) {
+          // Copy it from its source; a file that changed since it was packed fails.
+          uLong crc = crc32(0, Z_NULL, 0);
+          uint64_t copied = 0;
+          const bool from_disk = !e.path.empty();
+          ok = zip_pack_job::read_blocks(e, [&](const char *data, size_t n) {
+            if (from_disk)
+              crc = crc_update(crc, data, n);
+            copied += n;
+            out.write(data, n);
+          });
+          ok = ok && copied == p.size && (!from_disk || crc == p.crc);
+        }
+        else
+          out.write(p.data.data(), p.data.size());
+        ok = ok && !out.fail();
+
+        put32(central, 0x02014b50);
+        put16(central, version);
+        put16(central, version);
+        put16(central, 0x0800);
+        put16(central, p.method);
+        put16(central, e.dos_time);
+        put16(central, e.dos_date);
+        put32(central, p.crc);
+        put32(central, big? ZIP64_LIMIT : csize);
+        put32(central, big? ZIP64_LIMIT : p.size);
+        put16(central, e.name.size());
+        put16(central, big? 28 : 0);
+        put16(central, 0); // Comment
+        put16(central, 0); // Disk number
+        put16(central, 0); // Internal attributes
+        put32(central, e.is_dir? 0x10 : 0); // MS-DOS directory attribute
+        put32(central, big? ZIP64_LIMIT : offset);
+        central += e.name;
+        if (big) {
+          put16(central, 0x0001);
+          put16(central, 24);
+          put64(central, p.size);
+          put64(central, csize);
+          put64(central, offset);
+        }
+        offset += rec.size() + csize;
+      }
+      job.advance(ok);
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+      workers[i].join();
+    if (!ok)
+      return false;
+
+    // Finish with the central directory, and its Zip64 records if the
+    // archive is too large to describe otherwise.
+    const uint64_t count = entries.size(), cd_size = central.size(), cd_offset = offset;
+    rec.clear();
+    if (count >= 0xFFFF || cd_size >= ZIP64_LIMIT || cd_offset >= ZIP64_LIMIT) {
+      put32(rec, 0x06064b50);
+      put64(rec, 44);
+      put16(rec, 45);
+      put16(rec, 45);
+      put32(rec, 0);
+      put32(rec, 0);
+      put64(rec, count);
+      put64(rec, count);
+      put64(rec, cd_size);
+      put64(rec, cd_offset);
+      put32(rec, 0x07064b50);
+      put32(rec, 0);
+      put64(rec, cd_offset + cd_size);
+      put32(rec, 1);
+    }
+    put32(rec, 0x06054b50);
+    put16(rec, 0);
+    put16(rec, 0);
+    put16(rec, count >= 0xFFFF? 0xFFFF : count);
+    put16(rec, count >= 0xFFFF? 0xFFFF : count);
+    put32(rec, cd_size >= ZIP64_LIMIT? ZIP64_LIMIT : cd_size);
+    put32(rec, cd_offset >= ZIP64_LIMIT? ZIP64_LIMIT : cd_offset);
+    put16(rec, 0);
+    out.write(central.data(), central.size());
+    out.write(rec.data(), rec.size());
+    return !out.fail();
+  }
+}
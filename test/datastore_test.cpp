@@ -0,0 +1,125 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "unit_testing.hpp"
+#include <datastore.hpp>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+enum { F_NAME, F_X, F_Y, F_SPRITE, F_DEPTH, F_TAGS, F_CHILDREN };
+
+static std::string build_object(bool with_depth) {
+  eff::data_builder b(with_depth? 2 : 1);
+  std::vector<eff::data_builder::ref> children;
+  for (int i = 0; i < 3; ++i) {
+    eff::data_builder::ref name = b.add_string(i? "child" : "γειά, κόσμο! \xF0\x9F\x98\x80!");
+    b.start_table();
+    b.field_ref(F_NAME, name);
+    b.field<int32_t>(F_X, i * 10);
+    children.push_back(b.end_table());
+  }
+  eff::data_builder::ref kids = b.add_refs(children);
+  double tags[] = { 0.5, 1.5, 2.5 };
+  eff::data_builder::ref tagv = b.add_vector(tags, 3);
+  eff::data_builder::ref name = b.add_string("obj_player");
+  b.start_table();
+  b.field_ref(F_NAME, name);
+  b.field<int32_t>(F_X, -32);
+  b.field<int32_t>(F_Y, 64);
+  b.field<uint8_t>(F_SPRITE, 7);
+  if (with_depth)
+    b.field<double>(F_DEPTH, -100.25);
+  b.field_ref(F_TAGS, tagv);
+  b.field_ref(F_CHILDREN, kids);
+  return b.finish(b.end_table());
+}
+
+RUN_TEST("Verify eff::data_reader reads back what eff::data_builder wrote") {
+  const std::string buf = build_object(true);
+  eff::data_reader r(buf.data(), buf.size());
+  assert_true("Reader rejected a freshly built buffer;", r.good());
+  assert_equals(2, r.schema_version());
+
+  eff::data_table obj = r.root();
+  assert_true("Root table missing;", obj.good());
+  assert_equals("Name mismatch;", "obj_player", obj.get_string(F_NAME).str());
+  assert_equals(-32, obj.get<int32_t>(F_X));
+  assert_equals(64, obj.get<int32_t>(F_Y));
+  assert_equals(7, obj.get<uint8_t>(F_SPRITE));
+  assert_equals("Depth mismatch;", -401, int(obj.get<double>(F_DEPTH) * 4));
+
+  eff::data_vector<double> tags = obj.get_vector<double>(F_TAGS);
+  assert_equals(3, tags.size());
+  assert_equals("Vector element mismatch;", 3, int(tags[1] * 2));
+
+  eff::data_ref_vector kids = obj.get_refs(F_CHILDREN);
+  assert_equals(3, kids.size());
+  assert_equals(20, kids.get_table(2).get<int32_t>(F_X));
+  assert_false("Child tables have no sprite;", kids.get_table(2).has(F_SPRITE));
+}
+
+RUN_TEST("Verify eff::data_string views need no re-indexing") {
+  const std::string buf = build_object(false);
+  eff::data_reader r(buf.data(), buf.size());
+  eff::data_string s = r.root().get_refs(F_CHILDREN).get_table(0).get_string(F_NAME);
+  utf8::utf8_view v = s.view();
+  assert_equals("Length is not accurate;", 15, v.length());
+  assert_equals(0x03BA, v.at(6));
+  assert_equals(0x01F600, v.at(13));
+  assert_equals("Substring is not accurate;", "κόσμο", v.substdstr(6, 5));
+
+  utf8::utf8_string owned(v);
+  assert_equals(0x03BF, owned.at(10));
+  assert_equals("Adopted index disagrees with the view;", v.byte_of(9), owned.byte_of(9));
+}
+
+RUN_TEST("Verify old and new schema versions read each other") {
+  const std::string old_buf = build_object(false);
+  eff::data_table old_obj = eff::data_reader(old_buf.data(), old_buf.size()).root();
+  assert_false("Old data should not have a depth;", old_obj.has(F_DEPTH));
+  assert_equals("Missing fields should read as the given default;", 5, int(old_obj.get<double>(F_DEPTH, 5.0)));
+  assert_false("Ids past the end of a vtable should be absent;", old_obj.has(F_CHILDREN + 10));
+  assert_equals(64, old_obj.get<int32_t>(F_Y));
+
+  std::string bad = old_buf;
+  bad[0] = 'X';
+  assert_false("A buffer without the magic number must not be good;", eff::data_reader(bad.data(), bad.size()).good());
+}
+
+RUN_TEST("Verify malformed vtables are rejected") {
+  std::string buf = build_object(false);
+  const uint32_t root = eff::data_detail::load<uint32_t>(&buf[8]);
+  const uint32_t vtable = eff::data_detail::load<uint32_t>(&buf[root]);
+  const uint16_t vtable_size = eff::data_detail::load<uint16_t>(&buf[vtable]);
+  assert_equals("Vtables are a whole number of slots;", 0, vtable_size % 2);
+  
+  // Cut the last slot in half, so its second byte isn't covered by the size.
+  eff::data_detail::store<uint16_t>(&buf[vtable], vtable_size - 1);
+  bool threw = false;
+  try { eff::data_reader(buf.data(), buf.size()).root(); }
+  catch (const std::range_error&) { threw = true; }
+  assert_true("An odd vtable size must be rejected;", threw);
+  
+  eff::data_detail::store<uint16_t>(&buf[vtable], 2);
+  threw = false;
+  try { eff::data_reader(buf.data(), buf.size()).root(); }
+  catch (const std::range_error&) { threw = true; }
+  assert_true("A vtable too short for its own header must be rejected;", threw);
+  
+  eff::data_detail::store<uint16_t>(&buf[vtable], 4);
+  eff::data_table bare = eff::data_reader(buf.data(), buf.size()).root();
+  assert_false("A vtable with no slots has no fields;", bare.has(F_NAME));
+}
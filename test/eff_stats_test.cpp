@@ -0,0 +1,103 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "unit_testing.hpp"
+#include <eff_stats.hpp>
+#include <gdir.hpp>
+#include <utf8_string.hpp>
+#include <thread>
+#include <vector>
+
+RUN_TEST("Verify directory handles count the work done through them") {
+  eff::directory dir = eff::dirent("data/testfolder");
+  eff::stats opened = dir.statistics();
+  if (!eff::stats_enabled()) {
+    // Built without EFF_INSTRUMENT (see make Test INSTRUMENT=1).
+    assert_equals("Nothing should be counted;", 0, opened[eff::STAT_SYSCALLS]);
+    assert_equals(0, eff::global_statistics()[eff::STAT_ENTRIES_LISTED]);
+    return;
+  }
+  assert_true("Opening should have listed the root;", opened[eff::STAT_ENTRIES_LISTED] >= 3);
+  assert_equals("Opening should have read one listing;", 1, opened[eff::STAT_CACHE_MISSES]);
+  assert_true("opendir, readdir and closedir should be counted;", opened[eff::STAT_SYSCALLS] >= 3);
+  assert_true(opened[eff::STAT_ALLOCATIONS] > 0);
+
+  assert_true(dir.enter("beta"));
+  assert_true(dir.leave());
+  eff::stats walked = dir.statistics() - opened;
+  assert_equals("Entering should have read one listing;", 1, walked[eff::STAT_CACHE_MISSES]);
+  assert_equals("Leaving should have reused the parent's listing;", 1, walked[eff::STAT_CACHE_HITS]);
+
+  eff::directory other = eff::dirent_zip("data/testfolder.zip");
+  assert_equals("Handles should not share counters;", 0, other.statistics()[eff::STAT_SYSCALLS]);
+  assert_true(other.statistics()[eff::STAT_ENTRIES_LISTED] > 0);
+}
+
+namespace {
+  struct discard_sink: eff::content_sink {
+    bool consume(const char*, size_t) { return true; }
+  };
+}
+
+RUN_TEST("Verify overlays count the work their layers do for them") {
+  std::vector<eff::directory> layers;
+  layers.push_back(eff::dirent("data/override"));
+  layers.push_back(eff::dirent_zip("data/testfolder.zip"));
+  eff::directory overlay = eff::dirent_overlay(layers);
+  assert_true(overlay.enter("beta"));
+  if (!eff::stats_enabled())
+    return;
+  const eff::stats before = overlay.statistics();
+  
+  discard_sink sink;
+  eff::entry_info info;
+  assert_true("banana.txt comes from the override, on disk;", overlay.read_file("banana.txt", sink));
+  assert_true("blueberry.txt comes from the zip;", overlay.read_file("blueberry.txt", sink));
+  assert_true(overlay.stat("blueberry.txt", info));
+  const eff::stats read = overlay.statistics() - before;
+  assert_true("Reading from the disk layer should be charged to the overlay;", read[eff::STAT_SYSCALLS] >= 3);
+  assert_equals("Inflating from the zip layer should be charged to the overlay;", 19, read[eff::STAT_BYTES_DECOMPRESSED]);
+}
+
+RUN_TEST("Verify counters charged from several threads at once lose nothing") {
+  eff::stats_detail::counter_block shared;
+  const uint64_t per_thread = 200000;
+  auto charge = [&]() {
+    eff::stats_detail::handle_scope scope(shared);
+    for (uint64_t i = 0; i < per_thread; ++i)
+      eff::stats_detail::count(eff::STAT_CACHE_HITS, 1);
+  };
+  std::thread a(charge), b(charge);
+  charge();
+  a.join();
+  b.join();
+  assert_equals(3 * per_thread, shared.snapshot()[eff::STAT_CACHE_HITS]);
+}
+
+RUN_TEST("Verify global statistics include threads that have exited") {
+  if (!eff::stats_enabled())
+    return;
+  const eff::stats before = eff::global_statistics();
+  std::thread worker([]() {
+    utf8::utf8_string s(std::string(4096, 'x'));
+    eff::directory dir = eff::dirent("data/testfolder");
+    dir.enter_new("gamma");
+  });
+  worker.join();
+  const eff::stats delta = eff::global_statistics() - before;
+  assert_true("The worker's listings should be counted;", delta[eff::STAT_CACHE_MISSES] >= 2);
+  assert_true("The worker's string should have been indexed;", delta[eff::STAT_NS_BUILD_INDEX] > 0);
+  assert_true(delta[eff::STAT_ALLOCATIONS] > 0);
+}
@@ -0,0 +1,83 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "unit_testing.hpp"
+#include <gdir_diff.hpp>
+#include <zip_writer.hpp>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+
+RUN_TEST("Verify eff::diff finds nothing between a folder and its zip") {
+  eff::directory fs = eff::dirent("data/testfolder"), zip = eff::dirent_zip("data/testfolder.zip");
+  eff::diff_result same = eff::diff(zip, zip);
+  assert_true("A zip file should match itself;", same.empty() && same.complete);
+  assert_equals("Stored CRCs should settle every file;", 0, same.files_read);
+
+  eff::diff_result res = eff::diff(fs, zip);
+  assert_true("The folder should match its zip;", res.empty());
+  assert_true(res.complete);
+  assert_equals(4, res.files_compared);
+}
+
+RUN_TEST("Verify eff::diff reports added, removed and modified entries") {
+  char tmpl[] = "/tmp/eff_diff_XXXXXX";
+  assert_true("Couldn't create a temporary directory;", mkdtemp(tmpl) != NULL);
+  const string tmp = tmpl, zipfile = tmp + ".zip";
+  mkdir((tmp + "/sub").c_str(), 0755);
+  std::ofstream((tmp + "/kept.txt").c_str()) << "unchanged";
+  std::ofstream((tmp + "/edited.txt").c_str()) << "before";
+  std::ofstream((tmp + "/sub/gone.txt").c_str()) << "removed";
+  {
+    eff::zip_writer zw(zipfile, 2);
+    assert_true(zw.add_tree(tmp));
+    assert_true(zw.close());
+  }
+  std::ofstream((tmp + "/edited.txt").c_str()) << "after, and longer";
+  std::ofstream((tmp + "/sub/new.txt").c_str()) << "added";
+  unlink((tmp + "/sub/gone.txt").c_str());
+  mkdir((tmp + "/extra").c_str(), 0755);
+
+  eff::diff_result res = eff::diff(eff::dirent_zip(zipfile), eff::dirent(tmp));
+  assert_true(res.complete);
+  assert_equals("Expected four changes;", 4, res.changes.size());
+  assert_equals("edited.txt", res.changes[0].path);
+  assert_true(res.changes[0].kind == eff::diff_entry::MODIFIED);
+  assert_equals("extra", res.changes[1].path);
+  assert_true(res.changes[1].kind == eff::diff_entry::ADDED && res.changes[1].type == eff::ENTRY_DIRECTORY);
+  assert_equals("sub/gone.txt", res.changes[2].path);
+  assert_true(res.changes[2].kind == eff::diff_entry::REMOVED);
+  assert_equals("sub/new.txt", res.changes[3].path);
+  assert_true(res.changes[3].kind == eff::diff_entry::ADDED);
+  assert_equals("Sizes and times should settle every file;", 0, res.files_read);
+
+  eff::diff_options opt;
+  opt.trust_mtime = false;
+  opt.threads = 3;
+  res = eff::diff(eff::dirent_zip(zipfile), eff::dirent(tmp), opt);
+  assert_equals("Contents should have been compared;", 1, res.files_read);
+  assert_equals(4, res.changes.size());
+
+  unlink((tmp + "/kept.txt").c_str());
+  unlink((tmp + "/edited.txt").c_str());
+  unlink((tmp + "/sub/new.txt").c_str());
+  rmdir((tmp + "/sub").c_str());
+  rmdir((tmp + "/extra").c_str());
+  rmdir(tmp.c_str());
+  unlink(zipfile.c_str());
+}
@@ -15,9 +15,15 @@
 
 #include <set>
 #include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <memory_resource>
+#include <unistd.h>
 #include "unit_testing.hpp"
 
 #include <gdir.hpp>
+#include <gdir_memory.hpp>
 
 using std::set;
 using std::string;
@@ -100,3 +106,437 @@ RUN_TEST("Verify zip file iteration works as expected") {
   assert_true("Couldn't open directory for iteration", dir.is_open());
   test_file_structure(dir);
 }
+
+/// Check that batches of each size list what next_file() and next_directory() do.
+static void test_batches(eff::directory &dir, bool indexed) {
+  std::vector<string> dirs;
+  for (string dn = dir.first_directory(); !dn.empty(); dn = dir.next_directory())
+    dirs.push_back(dn);
+  eff::entry_view batch[2];
+  std::vector<string> batched;
+  dir.rewind_directories();
+  for (size_t n; (n = dir.next_directories(batch)); )
+    for (size_t i = 0; i < n; ++i) {
+      assert_true("Directories should be listed as such;", batch[i].type == eff::ENTRY_DIRECTORY);
+      batched.push_back(batch[i].str());
+    }
+  assert_true("Batched directories should match;", dirs == batched);
+  assert_equals("A finished batch should stay finished;", 0, dir.next_directories(batch));
+  
+  std::vector<string> visited;
+  dir.for_each_directory([&](const eff::entry_view &e) { visited.push_back(e.str()); });
+  assert_true("Visited directories should match;", dirs == visited);
+  assert_equals("Visiting shouldn't move the iterators;", 0, dir.next_directories(batch));
+  
+  assert_true(dir.enter("beta"));
+  std::vector<string> files;
+  for (string fn = dir.first_file(); !fn.empty(); fn = dir.next_file())
+    files.push_back(fn);
+  batched.clear();
+  dir.rewind_files();
+  for (size_t n; (n = dir.next_files(batch, 1)); ) {
+    assert_equals("Batches of one should hold one entry;", 1, n);
+    assert_equals("Indices should be given exactly for zip entries;", indexed, batch[0].index != eff::entry_view::no_index);
+    batched.push_back(batch[0].name);
+  }
+  assert_true("Batched files should match;", files == batched);
+  
+  visited.clear();
+  dir.rewind_files();
+  dir.for_each_file([&](const eff::entry_view &e) {
+    assert_equals("Zip entries should be visited with their metadata;", indexed, e.info != NULL);
+    visited.push_back(e.str());
+  });
+  assert_true("Visited files should match;", files == visited);
+  assert_equals("Visiting shouldn't move the iterators;", 1, dir.next_files(batch, 1));
+  assert_equals(files[0], batch[0].str());
+  assert_true(dir.leave());
+}
+
+RUN_TEST("Verify batches and visitors list the same entries as iteration") {
+  eff::directory fs = eff::dirent("data/testfolder");
+  test_batches(fs, false);
+  eff::directory zip = eff::dirent_zip("data/testfolder.zip");
+  test_batches(zip, true);
+  std::vector<eff::directory> layers;
+  layers.push_back(eff::dirent("data/override"));
+  layers.push_back(eff::dirent("data/testfolder"));
+  eff::directory overlay = eff::dirent_overlay(layers);
+  test_batches(overlay, false);
+}
+
+RUN_TEST("Verify overlay directories merge layers without duplicates") {
+  std::vector<eff::directory> layers;
+  layers.push_back(eff::dirent("data/override"));
+  layers.push_back(eff::dirent_zip("data/testfolder.zip"));
+  layers.push_back(eff::dirent("data/testfolder"));
+  eff::directory dir = eff::dirent_overlay(layers);
+  assert_true("Couldn't open overlay for iteration", dir.is_open());
+  
+  assert_equals("Overlay should list each directory once;", 3, dir.directory_count());
+  assert_equals("Overlay should list the override's files;", 2, dir.file_count());
+  assert_true("Overlay should find files from the first layer;", dir.has_file("readme.txt"));
+  
+  assert_true("Entering `beta' should have returned success;", dir.enter("beta"));
+  set<string> read_files;
+  for (string fname = dir.first_file(); !fname.empty(); fname = dir.next_file())
+    assert_true("File `" + fname + "' was listed twice;", read_files.insert(fname).second);
+  assert_equals("Files in `beta' should be the union of all layers;", 2, read_files.size());
+  assert_true("Leaving `beta' must return success;", dir.leave());
+  
+  eff::directory delta = dir.enter_new("delta");
+  assert_true("Entering `delta' should have returned a good directory;", delta.good());
+  assert_equals("date.txt", delta.first_file());
+  assert_false("There is no `alpha' in `delta';", delta.enter("alpha"));
+  assert_true("Leaving `delta' must return success;", delta.leave());
+  assert_equals("Leaving should return to the merged root;", 3, delta.directory_count());
+}
+
+RUN_TEST("Verify an overlay of no layers is an empty directory") {
+  eff::directory dir = eff::dirent_overlay(std::vector<eff::directory>());
+  assert_true("An empty overlay should still open;", dir.good());
+  assert_equals(0, dir.file_count());
+  assert_equals(0, dir.directory_count());
+  assert_equals("", dir.first_file());
+  assert_equals("", dir.first_directory());
+  assert_false(dir.has_file("readme.txt"));
+  assert_false(dir.enter("beta"));
+  assert_false("There's nothing to refresh;", dir.refresh());
+}
+
+RUN_TEST("Verify overlay files shadow directories of the same name") {
+  std::vector<eff::directory> layers;
+  layers.push_back(eff::dirent("data/override"));
+  layers.push_back(eff::dirent("data/testfolder"));
+  eff::directory dir = eff::dirent_overlay(layers);
+  
+  set<string> names;
+  for (string fname = dir.first_file(); !fname.empty(); fname = dir.next_file())
+    names.insert(fname);
+  for (string dname = dir.first_directory(); !dname.empty(); dname = dir.next_directory())
+    assert_true("`" + dname + "' was listed as both a file and a directory;", names.insert(dname).second);
+  assert_equals(5, names.size());
+  
+  assert_true("The override's `gamma' is a file;", dir.has_file("gamma"));
+  assert_false("The directory it shadows can't be entered;", dir.enter("gamma"));
+  assert_false(dir.enter_new("gamma").good());
+  
+  // The other way around, a directory shadows a file.
+  std::vector<eff::directory> reversed(layers.rbegin(), layers.rend());
+  eff::directory rev = eff::dirent_overlay(reversed);
+  assert_false("Now `gamma' is a directory;", rev.has_file("gamma"));
+  assert_true(rev.enter("gamma"));
+  assert_equals("grape.txt", rev.first_file());
+}
+
+RUN_TEST("Verify overlay directories pick up changes to a layer on refresh") {
+  char tmpl[] = "/tmp/eff_overlay_XXXXXX";
+  assert_true("Couldn't create a temporary directory;", mkdtemp(tmpl) != NULL);
+  const string tmp = tmpl;
+  
+  std::vector<eff::directory> layers;
+  layers.push_back(eff::dirent(tmp));
+  layers.push_back(eff::dirent("data/testfolder"));
+  eff::directory dir = eff::dirent_overlay(layers);
+  assert_false("Nothing has been added yet;", dir.has_file("new.txt"));
+  assert_false("Refreshing an unchanged overlay should report no change;", dir.refresh());
+  
+  // Another handle on the same level, partway through its listing.
+  eff::directory peer = dir.enter_new("alpha");
+  assert_true("Leaving `alpha' must return success;", peer.leave());
+  assert_equals("alpha", peer.first_directory());
+  
+  std::ofstream((tmp + "/new.txt").c_str()) << "fresh";
+  assert_true("Refreshing should notice the new file;", dir.refresh());
+  assert_equals("A refresh elsewhere shouldn't disturb a listing in progress;", "beta", peer.next_directory());
+  assert_equals("gamma", peer.next_directory());
+  assert_equals("", peer.next_directory());
+  assert_true("The new file should be visible after refresh;", dir.has_file("new.txt"));
+  assert_equals(3, dir.directory_count());
+  
+  unlink((tmp + "/new.txt").c_str());
+  rmdir(tmp.c_str());
+}
+
+RUN_TEST("Verify zip files inside zip files can be entered") {
+  eff::directory dir = eff::dirent_zip("data/nested.zip");
+  assert_true("Couldn't open directory for iteration", dir.is_open());
+  
+  eff::directory stored = dir.enter_new("inner_stored.zip");
+  assert_true("Entering a STORED inner archive should have returned a good directory;", stored.good());
+  test_file_structure(stored);
+  
+  assert_true("Entering `packs' should have returned success;", dir.enter("packs"));
+  assert_false("Plain files can't be entered;", dir.enter("notes.txt"));
+  assert_true("Entering a deflated inner archive should have returned success;", dir.enter("inner_deflated.zip"));
+  test_file_structure(dir);
+  assert_true("Leaving an inner archive's root should return success;", dir.leave());
+  assert_true("Leaving should return to the directory holding the inner archive;", dir.has_file("notes.txt"));
+  assert_true(dir.leave());
+  assert_false("The outer root has no parent;", dir.leave());
+  
+  eff::set_nested_archive_budget(0);
+  assert_true("Inner archives should open with nothing cached;", dir.enter_new("packs").enter("inner_deflated.zip"));
+  eff::set_nested_archive_budget(64 << 20);
+}
+
+RUN_TEST("Verify entry metadata is read with the archive") {
+  eff::directory zip = eff::dirent_zip("data/testfolder.zip"), fs = eff::dirent("data/testfolder");
+  assert_true(zip.enter("beta"));
+  assert_true(fs.enter("beta"));
+  eff::entry_info zi, fi;
+  assert_true("Zip entries should stat;", zip.stat("banana.txt", zi));
+  assert_true("Files on disk should stat;", fs.stat("banana.txt", fi));
+  assert_false("Missing files shouldn't stat;", zip.stat("cherry.txt", zi) || fs.stat("cherry.txt", fi));
+  assert_equals("Sizes should agree;", fi.size, zi.size);
+  assert_true("Zip entries should know their CRC;", zi.valid & eff::entry_info::HAS_CRC);
+  assert_equals(0xEDB04E09u, zi.crc);
+  assert_equals("banana.txt is deflated;", 8, zi.method);
+  assert_false("Files on disk have no CRC until read;", fi.valid & eff::entry_info::HAS_CRC);
+  
+  eff::entry_view batch[4];
+  zip.rewind_files();
+  const size_t n = zip.next_files(batch);
+  assert_equals(2, n);
+  assert_true("Zip batches should carry metadata;", batch[1].info != NULL);
+  assert_equals(19, batch[1].info->size);
+  fs.rewind_files();
+  fs.next_files(batch);
+  assert_true("Batches from disk shouldn't stat each file;", batch[0].info == NULL);
+  
+  std::vector<eff::directory> layers;
+  layers.push_back(eff::dirent("data/override"));
+  layers.push_back(eff::dirent_zip("data/testfolder.zip"));
+  eff::directory overlay = eff::dirent_overlay(layers);
+  assert_true(overlay.stat("readme.txt", fi));
+  assert_equals(19, fi.size);
+  assert_true(overlay.enter("beta"));
+  assert_true("Overlays should ask the layer providing the file;", overlay.stat("blueberry.txt", zi));
+  assert_equals(0x520058D4u, zi.crc);
+}
+
+struct string_sink: eff::content_sink {
+  string data;
+  bool consume(const char *d, size_t size) { data.append(d, size); return true; }
+};
+
+RUN_TEST("Verify files read the same from disk, zips and overlays") {
+  eff::directory fs = eff::dirent("data/testfolder"), zip = eff::dirent_zip("data/testfolder.zip");
+  assert_true(fs.enter("beta"));
+  assert_true(zip.enter("beta"));
+  string_sink from_fs, from_zip, from_overlay, missing;
+  assert_true("Reading from disk failed;", fs.read_file("banana.txt", from_fs));
+  assert_true("Reading a deflated zip entry failed;", zip.read_file("banana.txt", from_zip));
+  assert_equals(21, from_fs.data.size());
+  assert_equals("Contents should match;", from_fs.data, from_zip.data);
+  assert_false("Missing files can't be read;", zip.read_file("cherry.txt", missing) || fs.read_file("cherry.txt", missing));
+  
+  eff::directory overlay = eff::dirent_overlay(std::vector<eff::directory>(1, zip));
+  assert_true(overlay.read_file("blueberry.txt", from_overlay));
+  assert_equals(19, from_overlay.data.size());
+}
+
+RUN_TEST("Verify lookups can ignore case and composition") {
+  std::vector<eff::directory> layers(1, eff::dirent_zip("data/testfolder.zip"));
+  eff::directory mounted[] = {
+    eff::dirent("data/testfolder"), eff::dirent_zip("data/testfolder.zip"), eff::dirent_overlay(layers)
+  };
+  for (eff::directory &dir : mounted) {
+    assert_false("Lookups should be exact by default;", dir.enter("BETA"));
+    dir.set_lookup(eff::LOOKUP_FOLDED);
+    eff::directory copy = dir;
+    assert_true("A folded lookup should enter `BETA';", copy.enter("BETA"));
+    assert_true(copy.has_file("Banana.TXT"));
+    eff::entry_info info;
+    string_sink contents;
+    assert_true(copy.stat("BLUEBERRY.txt", info) && copy.read_file("BLUEBERRY.txt", contents));
+    assert_equals(19, contents.data.size());
+    assert_false("Folding mustn't match other names;", copy.has_file("banana.txt.bak"));
+    eff::directory entered = dir.enter_new("Gamma");
+    assert_true("Entered directories should inherit the lookup mode;", entered.good() && entered.has_file("GRAPE.TXT"));
+  }
+  
+  char tmpl[] = "/tmp/eff_fold_XXXXXX";
+  assert_true("Couldn't create a temporary directory;", mkdtemp(tmpl) != NULL);
+  const string tmp = tmpl;
+  std::ofstream((tmp + "/Re\xCC\x81sume\xCC\x81.txt").c_str()) << "decomposed";
+  std::ofstream((tmp + "/a.txt").c_str()) << "lower";
+  std::ofstream((tmp + "/A.txt").c_str()) << "upper";
+  eff::directory dir = eff::dirent(tmp);
+  dir.set_lookup(eff::LOOKUP_FOLDED);
+  assert_true("Composed names should find decomposed files;", dir.has_file("R\xC3\x89SUM\xC3\x89.TXT"));
+  string_sink upper;
+  assert_true(dir.read_file("A.txt", upper));
+  assert_equals("An exact match should win over a folded one;", "upper", upper.data);
+  
+  unlink((tmp + "/Re\xCC\x81sume\xCC\x81.txt").c_str());
+  unlink((tmp + "/a.txt").c_str());
+  unlink((tmp + "/A.txt").c_str());
+  rmdir(tmp.c_str());
+}
+
+/// Count the entries below a directory, entering each subdirectory in turn.
+static size_t count_tree(eff::directory dir) {
+  size_t count = dir.file_count();
+  for (string dn = dir.first_directory(); !dn.empty(); dn = dir.next_directory()) {
+    eff::directory sub = dir.enter_new(dn);
+    count += 1 + (sub.good()? count_tree(sub) : 0);
+  }
+  return count;
+}
+
+RUN_TEST("Verify prefetched directory walks see the same tree") {
+  eff::directory dir = eff::dirent("data/testfolder", eff::prefetch_options(2, 2, 3));
+  assert_true("Couldn't open directory for iteration", dir.is_open());
+  test_file_structure(dir);
+  assert_equals(count_tree(eff::dirent("data")), count_tree(eff::dirent("data", eff::prefetch_options(1, 3, 2))));
+  
+  eff::memory_backend fs;
+  fs.add_file("alpha/apple.txt");
+  fs.add_file("beta/banana.txt");
+  fs.add_file("beta/blueberry.txt");
+  fs.add_file("gamma/grape.txt");
+  eff::directory warm = eff::dirent("", fs, eff::prefetch_options(3, 1, 1));
+  // Wait for the worker to start on all three subdirectories. A listing
+  // still in progress is waited for when entered, not read again.
+  for (int ms = 0; fs.list_calls() < 4 && ms < 5000; ++ms)
+    usleep(1000);
+  assert_equals("The worker should have listed the root's subdirectories;", 4, fs.list_calls());
+  const eff::stats before = warm.statistics();
+  assert_true(warm.enter_new("alpha").good() && warm.enter("beta"));
+  assert_true(warm.has_file("blueberry.txt"));
+  assert_equals("Entering shouldn't list them again;", 4, fs.list_calls());
+  if (eff::stats_enabled())
+    assert_equals("Both subdirectories should have been listed ahead;", 2, (warm.statistics() - before)[eff::STAT_CACHE_HITS]);
+}
+
+/// Forwards to the heap, keeping track of what's still out.
+struct counting_resource: std::pmr::memory_resource {
+  size_t allocations, outstanding;
+  counting_resource(): allocations(0), outstanding(0) {}
+  void *do_allocate(size_t bytes, size_t alignment) {
+    ++allocations, outstanding += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void *p, size_t bytes, size_t alignment) {
+    outstanding -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept { return this == &other; }
+};
+
+RUN_TEST("Verify trees can be mounted in a caller's memory") {
+  counting_resource counted;
+  {
+    eff::directory fs = eff::dirent("data/testfolder", &counted), zip = eff::dirent_zip("data/nested.zip", &counted);
+    assert_true("Couldn't open directory for iteration", fs.is_open() && zip.is_open());
+    test_file_structure(fs);
+    eff::directory stored = zip.enter_new("inner_stored.zip");
+    assert_true(stored.good());
+    test_file_structure(stored);
+    assert_equals(count_tree(eff::dirent("data")), count_tree(eff::dirent("data", eff::prefetch_options(2, 2, 2), &counted)));
+    assert_true("Listings should have been allocated from the resource given;", counted.allocations > 0);
+  }
+  assert_equals("Everything should be given back once the handles are gone;", 0, counted.outstanding);
+  
+  std::pmr::monotonic_buffer_resource arena(&counted);
+  {
+    eff::directory zip = eff::dirent_zip("data/testfolder.zip", &arena);
+    test_file_structure(zip);
+    assert_true(zip.enter("alpha") && zip.leave());
+  }
+  arena.release();
+  assert_equals(0, counted.outstanding);
+}
+
+/// Copy a tree into memory, contents and all.
+static void mirror(eff::directory dir, eff::memory_backend &fs, const string &path) {
+  for (string fn = dir.first_file(); !fn.empty(); fn = dir.next_file()) {
+    string_sink contents;
+    assert_true(dir.read_file(fn, contents));
+    fs.add_file(path + "/" + fn, contents.data);
+  }
+  for (string dn = dir.first_directory(); !dn.empty(); dn = dir.next_directory()) {
+    fs.add_directory(path + "/" + dn);
+    mirror(dir.enter_new(dn), fs, path + "/" + dn);
+  }
+}
+
+RUN_TEST("Verify directories can be read from other backends") {
+  eff::memory_backend fs;
+  mirror(eff::dirent("data/testfolder"), fs, "/mem/testfolder");
+  eff::directory dir = eff::dirent("mem/testfolder", fs);
+  assert_true("Couldn't open directory for iteration", dir.is_open());
+  test_file_structure(dir);
+  assert_false("Missing directories shouldn't open;", eff::dirent("mem/nowhere", fs).is_open());
+  assert_false("Files aren't directories;", eff::dirent("mem/testfolder/beta/banana.txt", fs).is_open());
+  
+  eff::directory disk = eff::dirent("data/testfolder");
+  assert_true(dir.enter("beta") && disk.enter("beta"));
+  eff::entry_info info;
+  string_sink from_memory, from_disk;
+  assert_true(dir.stat("banana.txt", info));
+  assert_equals(21, info.size);
+  assert_true(dir.read_file("banana.txt", from_memory) && disk.read_file("banana.txt", from_disk));
+  assert_equals("Contents should match;", from_disk.data, from_memory.data);
+  
+  fs.add_file("mem/testfolder/beta/cherry.txt", "cherries");
+  assert_false("Changes shouldn't show until a refresh;", dir.has_file("cherry.txt"));
+  assert_true(dir.refresh());
+  assert_equals(3, dir.file_count());
+  assert_true(fs.remove("mem/testfolder/beta"));
+  assert_false("A removed directory can't be entered;", eff::dirent("mem/testfolder", fs).enter("beta"));
+  
+  // Listing ahead shouldn't list anything twice, however slow the backend.
+  fs.add_directory("mem/testfolder/beta");
+  fs.set_latency(std::chrono::milliseconds(2));
+  const size_t before = fs.list_calls();
+  const size_t plain = count_tree(eff::dirent("mem", fs));
+  const size_t listed = fs.list_calls() - before;
+  assert_equals(plain, count_tree(eff::dirent("mem", fs, eff::prefetch_options(2, 3, 4))));
+  assert_equals("Each directory should be listed once;", listed, fs.list_calls() - before - listed);
+}
+
+RUN_TEST("Verify copies of a handle move independently") {
+  eff::directory dir = eff::dirent_zip("data/testfolder.zip");
+  assert_equals("alpha", dir.first_directory());
+  eff::directory copy = dir;
+  assert_equals("A copy should start where the original was;", "beta", copy.next_directory());
+  assert_true(copy.enter("gamma"));
+  assert_equals("Moving a copy must not move the original;", "beta", dir.next_directory());
+  assert_equals(3, dir.directory_count());
+  assert_equals(1, copy.file_count());
+}
+
+RUN_TEST("Verify threads can share one mounted archive") {
+  eff::directory mounted[] = {
+    eff::dirent("data/testfolder"),
+    eff::dirent_zip("data/nested.zip"),
+    eff::dirent_overlay(std::vector<eff::directory>(1, eff::dirent_zip("data/testfolder.zip"))),
+    eff::dirent_zip("data/nested.zip")
+  };
+  mounted[1] = mounted[1].enter_new("inner_stored.zip");
+  assert_true(mounted[3].enter("packs"));
+  for (size_t m = 0; m < sizeof mounted / sizeof *mounted; ++m) {
+    const size_t nthreads = 8;
+    std::vector<string> failures(nthreads);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nthreads; ++t)
+      threads.push_back(std::thread([&, t]() {
+        try {
+          for (int rep = 0; rep < 20; ++rep) {
+            eff::directory mine = mounted[m];
+            if (mine.has_file("inner_deflated.zip")) // Each thread opens its own copy
+              assert_true("Entering a nested archive failed;", mine.enter("inner_deflated.zip"));
+            test_file_structure(mine);
+          }
+        } catch (const assertion_failure &f) {
+          failures[t] = f.what();
+        }
+      }));
+    for (size_t t = 0; t < nthreads; ++t) {
+      threads[t].join();
+      assert_equals("A thread iterating a shared handle failed;", "", failures[t]);
+    }
+  }
+}
@@ -15,6 +15,7 @@
 
 #include "unit_testing.hpp"
 #include <utf8_string.hpp>
+#include <utf8_fold.hpp>
 #include <string>
 
 RUN_TEST("Verify utf8::utf8_string.at() returns correct character value") {
@@ -56,3 +57,89 @@ RUN_TEST("Test utf8::utf8_string per-character assembly and disassembly using su
     output += input.substdstr(i, 1);
   assert_equals("String assembled from per-character substrings does not match original;", input, output);
 }
+
+RUN_TEST("Verify utf8::pmr::utf8_string allocates from its resource") {
+  char buffer[1024];
+  std::pmr::monotonic_buffer_resource arena(buffer, sizeof buffer, std::pmr::null_memory_resource());
+  utf8::pmr::utf8_string str("\xCE\xB3\xCE\xB5\xCE\xB9\xCE\xAC, \xCE\xBA\xCF\x8C\xCF\x83\xCE\xBC\xCE\xBF! "
+                             "a long enough tail to need more than the small string buffer", &arena);
+  assert_true("The string should live in the arena;", str.get_allocator().resource() == &arena);
+  assert_equals(0x03BA, str.at(6));
+  assert_equals("Substring is not accurate;", "\xCE\xBA\xCF\x8C\xCF\x83\xCE\xBC\xCE\xBF", str.substdstr(6, 5));
+  utf8::pmr::utf8_string copy(str, &arena);
+  copy += "!";
+  assert_equals(str.length() + 1, copy.length());
+  assert_equals("Conversion should keep the bytes;", std::string(str) + "!", std::string(copy));
+}
+
+RUN_TEST("Verify utf8::utf8_string maps characters to lines and columns") {
+  utf8::utf8_string str = "\xCE\xB3\xCE\xB5\xCE\xB9\xCE\xAC,\n\xCE\xBA\xCF\x8C\xCF\x83\xCE\xBC\xCE\xBF!\n\n\xF0\x9F\x98\x80 end";
+  assert_equals(4, str.line_count());
+  assert_equals("The newline ends its own line;", 0, str.line_col_of(5).line);
+  assert_equals(5, str.line_col_of(5).column);
+  assert_equals(1, str.line_col_of(8).line);
+  assert_equals("Columns count characters, not bytes;", 2, str.line_col_of(8).column);
+  assert_equals(3, str.line_col_of_byte(str.size() - 3).line);
+  assert_equals(2, str.line_col_of_byte(str.size() - 3).column);
+  assert_equals(8, str.offset_of(1, 2));
+  assert_equals("A column may be a line's length;", 13, str.offset_of(2, 0));
+  assert_equals(str.length(), str.offset_of(3, 5));
+  for (size_t bad = 0; bad < 2; ++bad) {
+    bool threw = false;
+    try { str.offset_of(bad? 4 : 2, bad? 0 : 1); }
+    catch (const std::range_error&) { threw = true; }
+    assert_true("Positions past a line or the last line should throw;", threw);
+  }
+  
+  // Every character should round trip, against a scan from the start.
+  size_t line = 0, column = 0;
+  for (size_t i = 0; i <= str.length(); ++i) {
+    assert_equals(line, str.line_col_of(i).line);
+    assert_equals(column, str.line_col_of(i).column);
+    assert_equals(i, str.offset_of(line, column));
+    assert_equals(i, str.char_of_byte(str.byte_of(i)));
+    if (i < str.length() && str.at(i) == '\n')
+      ++line, column = 0;
+    else
+      ++column;
+  }
+  
+  str += "\nmore";
+  assert_equals("Appending should discard the old line index;", 5, str.line_count());
+  assert_equals(str.length() - 4, str.offset_of(4, 0));
+}
+
+RUN_TEST("Verify utf8::utf8_string::find and rfind return character indices") {
+  const utf8::utf8_string str = "\xCE\xB3\xCE\xB5\xCE\xB9\xCE\xAC, \xCE\xBA\xCF\x8C\xCF\x83\xCE\xBC\xCE\xBF! \xCE\xBA\xCF\x8C\xCF\x83\xCE\xBC\xCE\xBF";
+  assert_equals(6, str.find("\xCE\xBA\xCF\x8C\xCF\x83\xCE\xBC\xCE\xBF"));
+  assert_equals(13, str.find("\xCE\xBA\xCF\x8C\xCF\x83\xCE\xBC\xCE\xBF", 7));
+  assert_equals(13, str.rfind("\xCE\xBA\xCF\x8C\xCF\x83\xCE\xBC\xCE\xBF"));
+  assert_equals(6, str.rfind("\xCE\xBA\xCF\x8C\xCF\x83\xCE\xBC\xCE\xBF", 12));
+  assert_equals(8, str.find(U'\x03C3'));
+  assert_equals(15, str.rfind(U'\x03C3'));
+  assert_equals(11, str.find('!'));
+  assert_equals(0, str.find(""));
+  assert_equals(utf8::utf8_string::npos, str.find("z"));
+  assert_equals(0, str.rfind(U'\x03B3', 0));
+  assert_equals(utf8::utf8_string::npos, str.find(U'\x03B3', 1));
+  assert_equals(utf8::utf8_string::npos, str.find('!', 30));
+  
+  const utf8::utf8_string same = str.str(), other = "\xCE\xB3";
+  assert_true(str == same && !(str != same));
+  assert_true(str != other && !(str == other));
+}
+
+RUN_TEST("Verify utf8::fold_key ignores case and composition") {
+  assert_equals("ASCII names should just be lowercased;", "sprites/player.png", utf8::fold_key("Sprites/Player.PNG"));
+  assert_equals("Composed and decomposed accents should fold alike;",
+                utf8::fold_key("R\xC3\xA9sum\xC3\xA9"), utf8::fold_key("Re\xCC\x81sume\xCC\x81"));
+  assert_equals("Keys should be composed;", "r\xC3\xA9sum\xC3\xA9", utf8::fold_key("RE\xCC\x81SUME\xCC\x81"));
+  assert_equals("Greek should fold, final sigma too;", utf8::fold_key("\xCE\xA3\xCE\x9F\xCE\xA6\xCE\x8A\xCE\x91"),
+                utf8::fold_key("\xCF\x83\xCE\xBF\xCF\x86\xCE\xAF\xCE\xB1"));
+  assert_equals("Cyrillic should fold;", utf8::fold_key("\xD0\x81\xD0\xBB\xD0\xBA\xD0\xB0"),
+                utf8::fold_key("\xD0\xB5\xCC\x88\xD0\xBB\xD0\xBA\xD0\xB0"));
+  assert_equals("Stacked marks should compose in canonical order;", "\xE1\xBB\x87",
+                utf8::fold_key("E\xCC\x82\xCC\xA3"));
+  assert_equals("Invalid UTF-8 should only have ASCII lowercased;", "\xFF" "abc", utf8::fold_key("\xFF" "ABC"));
+  assert_false("Different names must stay different;", utf8::fold_key("r\xC3\xA9sum\xC3\xA9") == utf8::fold_key("resume"));
+}
@@ -0,0 +1,194 @@
+/** Copyright (C) 2014 Josh Ventura
+ * This file is part of ENIGMA.
+ *
+ * ENIGMA is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License, or (at your option) any later version.
+ *
+ * ENIGMA is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ENIGMA. If not, see <http://www.gnu.org/licenses/>.
+**/
+
+#include "unit_testing.hpp"
+#include <zip_writer.hpp>
+#include <gdir.hpp>
+#include <zlib.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+using std::string;
+
+/// Read a whole entry back through the directory API.
+static string read_back(const eff::directory &dir, const string &name) {
+  struct sink: eff::content_sink {
+    string data;
+    bool consume(const char *d, size_t size) { data.append(d, size); return true; }
+  } s;
+  if (!dir.read_file(name, s))
+    return "<unreadable>";
+  return s.data;
+}
+
+static uint32_t crc_of(const string &data) {
+  return crc32(crc32(0, Z_NULL, 0), (const Bytef*) data.data(), data.size());
+}
+
+/// Text that compresses, but not to a few repeated bytes.
+static string sample_text(size_t lines) {
+  std::stringstream ss;
+  for (size_t i = 0; i < lines; ++i)
+    ss << "Line " << i << " of " << lines << ", checksum " << (i * 2654435761u % 1000003) << ".\n";
+  return ss.str();
+}
+
+RUN_TEST("Verify eff::zip_writer packs a directory tree that reads back") {
+  const string zipfile = "/tmp/eff_zip_writer_test.zip";
+  {
+    eff::zip_writer zw(zipfile, 3);
+    assert_true("Couldn't add the test folder;", zw.add_tree("data/testfolder", "testfolder"));
+    zw.add_memory("notes/readme.txt", string(4096, 'x'));
+    zw.add_memory("notes/image.png", string(4096, 'x'));
+    zw.add_memory("notes/log.txt", sample_text(4000));
+    zw.add_directory("empty");
+    assert_true("Writing the archive failed;", zw.close());
+  }
+
+  eff::directory dir = eff::dirent_zip(zipfile);
+  assert_true("Couldn't open the written archive;", dir.is_open());
+  assert_equals("Root should hold testfolder, notes and empty;", 3, dir.directory_count());
+  assert_true("Entering `empty' should have returned success;", dir.enter("empty"));
+  assert_equals(0, dir.file_count());
+  assert_true(dir.leave());
+  assert_true("Entering `testfolder' should have returned success;", dir.enter("testfolder"));
+  assert_equals(3, dir.directory_count());
+  assert_true("Entering `beta' should have returned success;", dir.enter("beta"));
+  assert_true("beta/blueberry.txt should have been packed;", dir.has_file("blueberry.txt"));
+  assert_equals(2, dir.file_count());
+
+  eff::directory beta = eff::dirent("data/testfolder");
+  assert_true(beta.enter("beta"));
+  assert_equals("Files packed from disk should read back intact;", read_back(beta, "blueberry.txt"), read_back(dir, "blueberry.txt"));
+  assert_true(dir.leave());
+  assert_true(dir.leave());
+
+  // Stored and deflated entries, read back with the sizes and CRCs recorded for them.
+  eff::entry_info info;
+  assert_true(dir.enter("notes"));
+  assert_true(dir.stat("image.png", info));
+  assert_equals("Extensions of compressed formats should be stored;", 0, info.method);
+  assert_equals(crc_of(string(4096, 'x')), info.crc);
+  assert_equals("Stored entries should read back intact;", string(4096, 'x'), read_back(dir, "image.png"));
+  assert_true(dir.stat("readme.txt", info));
+  assert_equals("Large text should be deflated;", 8, info.method);
+  assert_true(info.compressed_size < info.size);
+  assert_equals(crc_of(string(4096, 'x')), info.crc);
+  assert_equals("Deflated entries should read back intact;", string(4096, 'x'), read_back(dir, "readme.txt"));
+  const string log = sample_text(4000);
+  assert_true(dir.stat("log.txt", info));
+  assert_equals(8, info.method);
+  assert_equals(log.size(), info.size);
+  assert_equals(crc_of(log), info.crc);
+  assert_true("Deflated entries should read back intact;", log == read_back(dir, "log.txt"));
+
+  unlink(zipfile.c_str());
+}
+
+RUN_TEST("Verify eff::zip_writer writes Zip64 records for many entries") {
+  const string zipfile = "/tmp/eff_zip_writer_test64.zip";
+  const size_t count = 70000;
+  {
+    eff::zip_writer zw(zipfile, 2);
+    for (size_t i = 0; i < count; ++i) {
+      std::stringstream name;
+      name << "entries/" << i << ".txt";
+      zw.add_memory(name.str(), name.str());
+    }
+    assert_true("Writing the archive failed;", zw.close());
+  }
+
+  eff::directory dir = eff::dirent_zip(zipfile);
+  assert_true("Couldn't open the written archive;", dir.is_open());
+  assert_true(dir.enter("entries"));
+  assert_equals("Every entry should be listed;", count, dir.file_count());
+  assert_true(dir.has_file("69999.txt"));
+  // Entries past the 65535th are only reachable through the Zip64 records.
+  assert_equals("entries/0.txt", read_back(dir, "0.txt"));
+  assert_equals("entries/65536.txt", read_back(dir, "65536.txt"));
+  assert_equals("entries/69999.txt", read_back(dir, "69999.txt"));
+
+  unlink(zipfile.c_str());
+}
+
+/// Bytes that don't compress at all.
+static string noise(size_t size) {
+  string res(size, '\0');
+  uint32_t x = 2463534242u;
+  for (size_t i = 0; i < size; ++i) {
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+    res[i] = char(x);
+  }
+  return res;
+}
+
+RUN_TEST("Verify eff::zip_writer streams entries spanning many blocks") {
+  const string zipfile = "/tmp/eff_zip_writer_big.zip", text_file = "/tmp/eff_zip_writer_big.txt",
+               image_file = "/tmp/eff_zip_writer_big.png";
+  // Each is several times zlib's input block, and not a whole number of them.
+  const string text = sample_text(90001), random = noise(3u << 20 | 77);
+  std::ofstream(text_file.c_str(), std::ios::binary) << text;
+  std::ofstream(image_file.c_str(), std::ios::binary) << random;
+  {
+    eff::zip_writer zw(zipfile, 2);
+    zw.add_file("text.txt", text_file);
+    zw.add_file("image.png", image_file);
+    zw.add_memory("noise.bin", random);
+    zw.add_memory("text_copy.txt", text);
+    assert_true("Writing the archive failed;", zw.close());
+  }
+
+  eff::directory dir = eff::dirent_zip(zipfile);
+  assert_true("Couldn't open the written archive;", dir.is_open());
+  eff::entry_info info;
+  assert_true(dir.stat("text.txt", info));
+  assert_equals("Text streamed from disk should be deflated;", 8, info.method);
+  assert_equals(text.size(), info.size);
+  assert_equals(crc_of(text), info.crc);
+  assert_true("Deflated files should read back intact;", text == read_back(dir, "text.txt"));
+  assert_true(dir.stat("text_copy.txt", info));
+  assert_equals(8, info.method);
+  assert_true("Deflated memory should read back intact;", text == read_back(dir, "text_copy.txt"));
+  assert_true(dir.stat("noise.bin", info));
+  assert_equals("Data that doesn't compress should be stored;", 0, info.method);
+  assert_equals(crc_of(random), info.crc);
+  assert_true(random == read_back(dir, "noise.bin"));
+  assert_true(dir.stat("image.png", info));
+  assert_equals(0, info.method);
+  assert_equals(random.size(), info.compressed_size);
+  assert_true("Files stored from disk should read back intact;", random == read_back(dir, "image.png"));
+
+  unlink(zipfile.c_str());
+  unlink(text_file.c_str());
+  unlink(image_file.c_str());
+}
+
+RUN_TEST("Verify eff::zip_writer leaves nothing behind unless it succeeds") {
+  const string zipfile = "/tmp/eff_zip_writer_failed.zip";
+  {
+    eff::zip_writer zw(zipfile, 2);
+    zw.add_memory("first.txt", sample_text(100));
+    zw.add_file("missing.txt", "/tmp/eff_zip_writer_no_such_file.txt");
+    assert_false("Packing a missing file should fail;", zw.close());
+  }
+  assert_true("A failed archive should be removed;", access(zipfile.c_str(), F_OK) != 0);
+  {
+    eff::zip_writer zw(zipfile, 2);
+    zw.add_memory("first.txt", sample_text(100));
+  }
+  assert_true("A writer that was never closed should write nothing;", access(zipfile.c_str(), F_OK) != 0);
+}